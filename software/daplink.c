@@ -54,6 +54,7 @@
 #include "src/system.h"                     // system functions
 #include "src/delay.h"                      // delay functions
 #include "src/dap.h"                        // CMSIS-DAP functions
+#include "src/usb_hid.h"                    // USB HID functions
 #include "src/usb_cdc.h"                    // USB CDC functions
 #include "src/uart.h"                       // UART functions
 
@@ -68,8 +69,10 @@ void UART_ISR(void) __interrupt(INT_NO_UART0) {
   UART_interrupt();
 }
 
-// Number of received bytes in endpoint
-extern volatile __xdata uint8_t HID_byteCount;
+void DAP_TIMER_interrupt(void);
+void TMR0_ISR(void) __interrupt(INT_NO_TMR0) {
+  DAP_TIMER_interrupt();
+}
 
 // ===================================================================================
 // Main Function
@@ -85,11 +88,9 @@ void main(void) {
   // Loop
   while(1) {
     // Handle DAP
-    if(HID_byteCount && !UEP1_T_LEN) {      // DAP packet received and out buffer empty?                      
+    if(HID_available()) {                   // DAP packet received in packet ring?
       DAP_Thread();                         // handle DAP packet
-      HID_byteCount = 0;                    // clear byte counter
-      UEP1_T_LEN = 64;                      // Windows hangs if smaller
-      UEP1_CTRL = UEP1_CTRL & ~(MASK_UEP_R_RES | MASK_UEP_T_RES); // send/receive package
+      HID_transmit();                       // send response, release ring slot
     }
 
     // Handle virtual COM
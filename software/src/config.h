@@ -15,6 +15,17 @@
 #define PIN_RXD             P30       // pin connected to RXD via 470R resistor
 #define PIN_TXD             P31       // pin connected to TXT via 470R resistor
 
+// DAP I/O kernels
+#define DAP_ASM_KERNEL      1         // 1: assembly kernels (dap_io.c), 0: C versions
+
+// SWD multi-drop (DAP_TargetSelect)
+#define DAP_TARGET_COUNT    4         // targets with saved SELECT/power state (1..8)
+
+// Target reset sequence (DAP_ResetTarget)
+#define DAP_RESET_ENABLE    1         // 1: ResetTarget pulses nRESET, 0: not implemented
+#define DAP_RESET_PULSE_us  1000      // nRESET low time in us
+#define DAP_RESET_WAIT_us   10000     // wait time after releasing nRESET in us
+
 // USB device descriptor
 #define USB_VENDOR_ID       0x1A86    // VID
 #define USB_PRODUCT_ID      0x8011    // PID
@@ -33,6 +33,17 @@
 
 #pragma disable_warning 110
 
+// ===================================================================================
+// Command dispatch
+// Every command handler gets the request pointer as its only argument (so it can be
+// called through the dispatch table) and writes its response to DAP_response.
+// Connect/Disconnect bind DAP_commands to the dispatch table of the selected port.
+// ===================================================================================
+typedef uint16_t (*DAP_Handler)(const __xdata uint8_t *req);
+extern __code DAP_Handler DAP_commandTable[3][DAP_COMMAND_COUNT];
+const DAP_Handler __code * __data DAP_commands = DAP_commandTable[DAP_PORT_DISABLED];
+__xdata uint8_t * __data DAP_response;
+
 // ===================================================================================
 // Get DAP Information
 //   id:      info identifier
@@ -47,9 +58,16 @@ static uint8_t DAP_Info(uint8_t id, __xdata uint8_t *info) {
       strcpy(info, DAP_FW_VER );
       break;
     case DAP_ID_CAPABILITIES:
-      info[0] = DAP_PORT_SWD | DAP_PORT_JTAG;
+      info[0] = DAP_CAP_SWD | DAP_CAP_JTAG | DAP_CAP_ATOMIC | DAP_CAP_TIMESTAMP;
       length = 1U;
       break;
+    case DAP_ID_TIMESTAMP_CLOCK:
+      info[0] = (uint8_t)(TIMESTAMP_CLOCK >>  0);
+      info[1] = (uint8_t)(TIMESTAMP_CLOCK >>  8);
+      info[2] = (uint8_t)(TIMESTAMP_CLOCK >> 16);
+      info[3] = (uint8_t)(TIMESTAMP_CLOCK >> 24);
+      length = 4U;
+      break;
     case DAP_ID_PACKET_SIZE:
       info[0] = DAP_PACKET_SIZE;
       info[1] = 0;
@@ -65,13 +83,29 @@ static uint8_t DAP_Info(uint8_t id, __xdata uint8_t *info) {
   return length;
 }
 
+// ===================================================================================
+// Process Info command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_GetInfo(const __xdata uint8_t *req) {
+  uint8_t num;
+  num = DAP_Info(*req, DAP_response + 1);
+  *DAP_response = num;
+  return((1U << 8) | (num + 1U));
+}
+
 // ===================================================================================
 // Process Host Status AKA DAP_LED command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_HostStatus(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_HostStatus(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   *res = DAP_OK;
   switch(*req) {
     case DAP_DEBUGGER_CONNECTED:
@@ -83,17 +117,23 @@ static uint8_t DAP_HostStatus(const __xdata uint8_t *req, __xdata uint8_t *res)
     default:
       *res = DAP_ERROR;
   }
-  return 1;
+  return((2U << 8) | 1U);
 }
 
 // ===================================================================================
 // Process Connect command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
 __idata uint8_t debug_port;
-static uint8_t DAP_Connect(const __xdata uint8_t *req, __xdata uint8_t *res) {
+__idata uint8_t swd_shadow_valid = 0U;            // SELECT/CSW/TAR shadow cache
+__xdata uint8_t swd_target_valid = 0U;            // multi-drop targets with saved state
+__idata uint8_t swd_target = 0U;                  // selected multi-drop target slot
+__idata uint8_t jtag_ir_valid = 0U;               // TAPs with cached IR (see JTAG_IR)
+static uint16_t DAP_Connect(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   uint8_t port;
   if(*req == DAP_PORT_AUTODETECT) port = DAP_DEFAULT_PORT;
   else port = *req;
@@ -112,20 +152,32 @@ static uint8_t DAP_Connect(const __xdata uint8_t *req, __xdata uint8_t *res) {
       break;
   }
 
+  // Bind command dispatch table to the selected port
+  DAP_commands = DAP_commandTable[debug_port];
+  swd_shadow_valid = 0U;
+  swd_target_valid = 0U;
+  swd_target = 0U;
+  jtag_ir_valid = 0U;
   *res = port;
-  return 1;
+  return((1U << 8) | 1U);
 }
 
 // ===================================================================================
 // Process Disconnect command and prepare response
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_Disconnect(__xdata uint8_t *res) {
-  *res = DAP_OK;
+static uint16_t DAP_Disconnect(const __xdata uint8_t *req) {
+  req;                                            // stop unreferenced arg warning
+  *DAP_response = DAP_OK;
   debug_port = DAP_PORT_DISABLED;
+  DAP_commands = DAP_commandTable[DAP_PORT_DISABLED];
+  swd_shadow_valid = 0U;
+  jtag_ir_valid = 0U;
   PORT_OFF();
-  return 1;
+  return 1U;
 }
 
 // ===================================================================================
@@ -135,20 +187,12 @@ static uint8_t DAP_Disconnect(__xdata uint8_t *res) {
 //   return: none
 // ===================================================================================
 void SWJ_Sequence(uint8_t count, const __xdata uint8_t *data) {
-  uint8_t val;
   uint8_t n;
 
-  val = 0U;
-  n   = 0U;
-  while(count--) {
-    if(n == 0U) {
-      val = *data++;
-      n   = 8U;
-    }
-
-    SWD_WRITE_BIT(val);
-    val >>= 1;
-    n--;
+  while(count) {
+    n = (count > 8U) ? 8U : count;
+    SWD_WriteBits(*data++, n);
+    count -= n;
   }
 }
 
@@ -160,148 +204,279 @@ void SWJ_Sequence(uint8_t count, const __xdata uint8_t *data) {
 //   return: none
 // ===================================================================================
 void SWD_Sequence(uint8_t info, const __xdata uint8_t *swdo, __xdata uint8_t *swdi) {
-  uint8_t val;
-  uint8_t bit;
   uint8_t n, k;
 
   n = info & SWD_SEQUENCE_CLK;
   if(n == 0U) n = 64U;
 
-  if(info & SWD_SEQUENCE_DIN) {
-    while(n) {
-      val = 0U;
-      for (k = 8U; k && n; k--, n--) {
-        SWD_READ_BIT(bit);
-        val >>= 1;
-        val |= bit << 7;
-      }
-      val >>= k;
-      *swdi++ = (uint8_t)val;
-    }
-  }
-  else {
-    while(n) {
-      val = *swdo++;
-      for(k = 8U; k && n; k--, n--) {
-        SWD_WRITE_BIT(val);
-        val >>= 1;
-      }
-    }
+  while(n) {
+    k = (n > 8U) ? 8U : n;
+    if(info & SWD_SEQUENCE_DIN) *swdi++ = SWD_ReadBits(k);
+    else                        SWD_WriteBits(*swdo++, k);
+    n -= k;
   }
 }
 
+// ===================================================================================
+// Timestamp
+// Timer0 runs at TIMESTAMP_CLOCK, its overflows are counted by the interrupt.
+// DAP_Timestamp captures the 32-bit timestamp into timestamp[].
+// ===================================================================================
+__xdata uint8_t timestamp[4];
+volatile __data uint16_t timestamp_overflow = 0U;
+
+void DAP_TIMER_interrupt(void) {
+  timestamp_overflow++;
+}
+
+void DAP_Timestamp(void) {
+  uint8_t lo, hi;
+  uint16_t overflow;
+  EA = 0;                                         // no interrupts while capturing
+  do {
+    hi = TH0;
+    lo = TL0;
+  } while(hi != TH0);                             // TL0 overflowed while reading
+  overflow = timestamp_overflow;
+  if(TF0 && !(hi & 0x80)) overflow++;             // overflow not yet counted
+  EA = 1;
+  timestamp[0] = lo;
+  timestamp[1] = hi;
+  timestamp[2] = (uint8_t)overflow;
+  timestamp[3] = (uint8_t)(overflow >> 8);
+}
+
+// Store captured timestamp in response
+static __xdata uint8_t *DAP_PutTimestamp(__xdata uint8_t *res) {
+  *res++ = timestamp[0];
+  *res++ = timestamp[1];
+  *res++ = timestamp[2];
+  *res++ = timestamp[3];
+  return res;
+}
+
 // ===================================================================================
 // SWD Transfer I/O
 //   request: A[3:2] RnW APnDP
 //   data:    DATA[31:0]
 //   return:  ACK[2:0]
+// The transfer function is generated in a fast variant without any delay and with
+// the default SWD configuration (1 cycle turnaround, no data phase) and in a slow
+// variant with the delay of the selected clock tier and the configured turnaround
+// and data phase (see DAP_SWD_Configure).
 // ===================================================================================
+#define SWD_TransferFunction(speed)                                                 \
+static uint8_t SWD_Transfer##speed(uint8_t req, __xdata uint8_t *data) {            \
+  uint8_t ack;                                                                      \
+  uint8_t bit;                                                                      \
+  uint8_t val;                                                                      \
+  uint8_t parity;                                                                   \
+  uint8_t m, n;                                                                     \
+                                                                                    \
+  /* Packet req (start, APnDP, RnW, A2, A3, parity, stop, park) */                  \
+  SWD_WriteByte(SWD_header[req & 0x0FU]);                                           \
+                                                                                    \
+  /* Turnaround */                                                                  \
+  SWD_OUT_DISABLE();                                                                \
+  SWD_TURNAROUND();                                                                 \
+                                                                                    \
+  /* Acknowledge res */                                                             \
+  SWD_READ_BIT(bit);                                                                \
+  ack = bit << 0;                                                                   \
+  SWD_READ_BIT(bit);                                                                \
+  ack |= bit << 1;                                                                  \
+  SWD_READ_BIT(bit);                                                                \
+  ack |= bit << 2;                                                                  \
+                                                                                    \
+  if(ack == DAP_TRANSFER_OK) {                                                      \
+    /* OK res */                                                                    \
+    /* Capture timestamp */                                                         \
+    if(req & DAP_TRANSFER_TIMESTAMP) DAP_Timestamp();                               \
+                                                                                    \
+    /* Data transfer */                                                             \
+    if(req & DAP_TRANSFER_RnW) {  /* read data */                                   \
+      parity = 0U;                                                                  \
+      for(m = 0; m < 4; m++) {                                                      \
+        val = SWD_ReadByte();     /* read RDATA[0:31] */                            \
+        ACC = val;                                                                  \
+        if(P) parity++;                                                             \
+        if(data) data[m] = val;                                                     \
+      }                                                                             \
+      SWD_READ_BIT(bit);          /* read parity */                                 \
+      if((parity ^ bit) & 1U)                                                       \
+        ack = DAP_TRANSFER_ERROR;                                                   \
+                                                                                    \
+      /* Turnaround */                                                              \
+      SWD_TURNAROUND();                                                             \
+      SWD_OUT_ENABLE();                                                             \
+    }                                                                               \
+    else {                        /* write data */                                  \
+      /* Turnaround */                                                              \
+      SWD_TURNAROUND();                                                             \
+      SWD_OUT_ENABLE();                                                             \
+                                                                                    \
+      /* Write WDATA[0:31] */                                                       \
+      parity = 0U;                                                                  \
+      for(m = 0; m < 4; m++) {                                                      \
+        val = data[m];                                                              \
+        ACC = val;                                                                  \
+        if(P) parity++;                                                             \
+        SWD_WriteByte(val);                                                         \
+      }                                                                             \
+      SWD_WRITE_BIT(parity);      /* write parity bit */                            \
+    }                                                                               \
+    /* Idle cycles */                                                               \
+    n = idle_cycles;                                                                \
+    if(n) {                                                                         \
+      SWD_SET(0);                                                                   \
+      for(; n; n--) SWD_CLOCK_CYCLE();                                              \
+    }                                                                               \
+    SWD_SET(1);                                                                     \
+    return(ack);                                                                    \
+  }                                                                                 \
+                                                                                    \
+  if((ack == DAP_TRANSFER_WAIT) || (ack == DAP_TRANSFER_FAULT)) {                   \
+    if(SWD_DATA_PHASE && (req & DAP_TRANSFER_RnW)) {                                \
+      for(n = 32U + 1U; n; n--)                                                     \
+        SWD_CLOCK_CYCLE();        /* dummy read RDATA[0:31] + parity */             \
+    }                                                                               \
+    /* Turnaround */                                                                \
+    SWD_TURNAROUND();                                                               \
+    SWD_OUT_ENABLE();                                                               \
+    if(SWD_DATA_PHASE && !(req & DAP_TRANSFER_RnW)) {                               \
+      SWD_SET(0);                                                                   \
+      for(n = 32U + 1U; n; n--)                                                     \
+        SWD_CLOCK_CYCLE();        /* dummy write WDATA[0:31] + parity */            \
+    }                                                                               \
+    SWD_SET(1);                                                                     \
+    return(ack);                                                                    \
+  }                                                                                 \
+                                                                                    \
+  /* Protocol error - clock out 32bits + parity + turnaround */                     \
+  n = 32U + 1U + SWD_TURNAROUND_CYCLES;                                             \
+  do {                                                                              \
+    SWD_CLOCK_CYCLE();            /* back off data phase */                         \
+  } while(--n);                                                                     \
+                                                                                    \
+  SWD_OUT_ENABLE();                                                                 \
+  SWD_SET(1);                                                                       \
+  return(ack);                                                                      \
+}
+
 __idata uint8_t idle_cycles;
-uint8_t SWD_Transfer(uint8_t req, __xdata uint8_t *data) {
-  uint8_t ack;
-  uint8_t bit = req;
-  uint8_t val;
-  uint8_t parity;
-  uint8_t m, n;
+__idata uint8_t swd_conf = 0U;
+__idata uint8_t swd_turnaround = 1U;
+__idata uint8_t swd_data_phase = 0U;
+__xdata uint8_t orun_detect = 0U;                 // see DAP_SWD_SetOverrun
+
+#undef  PIN_DELAY
+#define PIN_DELAY()             PIN_DELAY_FAST()
+#define SWD_TURNAROUND()        SWD_CLOCK_CYCLE()
+#define SWD_TURNAROUND_CYCLES   1U
+#define SWD_DATA_PHASE          swd_data_phase
+#if DAP_ASM_KERNEL == 0
+SWD_TransferFunction(Fast)                        // else assembly kernel in dap_io.c
+#endif
+
+#undef  PIN_DELAY
+#undef  SWD_TURNAROUND
+#undef  SWD_TURNAROUND_CYCLES
+#undef  SWD_DATA_PHASE
+#define PIN_DELAY()             PIN_DELAY_TIER()
+#define SWD_TURNAROUND()        for(n = swd_turnaround; n; n--) SWD_CLOCK_CYCLE()
+#define SWD_TURNAROUND_CYCLES   swd_turnaround
+#define SWD_DATA_PHASE          swd_data_phase
+SWD_TransferFunction(Slow)
+
+#undef  PIN_DELAY
+#define PIN_DELAY()             PIN_DELAY_TIER()
 
-  // Packet req
-  parity = 0U;
-  SWD_WRITE_BIT(1U);              // start bit
-  SWD_WRITE_BIT(bit);             // APnDP bit
-  parity += bit;
-  bit >>= 1;
-  SWD_WRITE_BIT(bit);             // RnW bit
-  parity += bit;
-  bit >>= 1;
-  SWD_WRITE_BIT(bit);             // A2 bit
-  parity += bit;
-  bit >>= 1;
-  SWD_WRITE_BIT(bit);             // A3 bit
-  parity += bit;
-  SWD_WRITE_BIT(parity);          // parity bit
-  SWD_WRITE_BIT(0U);              // stop bit
-  SWD_WRITE_BIT(1U);              // park bit
-
-  // Turnaround is always 1 cycle
-  SWD_OUT_DISABLE();
-  SWD_CLOCK_CYCLE();
-
-  // Acknowledge res
-  SWD_READ_BIT(bit);
-  ack = bit << 0;
-  SWD_READ_BIT(bit);
-  ack |= bit << 1;
-  SWD_READ_BIT(bit);
-  ack |= bit << 2;
-
-  if(ack == DAP_TRANSFER_OK) {
-    // OK res
-    // Data transfer
-    if(req & DAP_TRANSFER_RnW) {  // read data
-      val = 0U;
-      parity = 0U;
-      for(m = 0; m < 4; m++) {
-        for(n = 8U; n; n--) {
-          SWD_READ_BIT(bit);      // read RDATA[0:31]
-          parity += bit;
-          val >>= 1;
-          if(bit) val |= 0x80;
-         }
-         if(data) data[m] = val;
-      }
-      SWD_READ_BIT(bit);          // read parity
-      if((parity ^ bit) & 1U)
-        ack = DAP_TRANSFER_ERROR;
+// ===================================================================================
+// WAIT back-off (DAP_OPTION_WAIT_BACKOFF)
+// Counts the WAIT responses of the current batch and inserts idle cycles before the
+// retry, starting with wait_backoff_init and doubling up to wait_backoff_max.
+// ===================================================================================
+__xdata uint16_t wait_count = 0U;
+__xdata uint8_t  wait_backoff_init = 0U;
+__xdata uint8_t  wait_backoff_max = 0U;
+__xdata uint8_t  wait_backoff = 0U;
+static void DAP_WaitBackoff(void) {
+  uint8_t n;
 
-      // Turnaround
-      SWD_CLOCK_CYCLE();
-      SWD_OUT_ENABLE();
-    }
-    else {                        // write data
-      // Turnaround 
-      SWD_CLOCK_CYCLE();
-      SWD_OUT_ENABLE();
-
-      // Write WDATA[0:31]
-      parity = 0U;
-      for(m = 0; m < 4; m++) {
-        val = data[m];
-        ACC = val;
-        if(P) parity++;
-        for(n = 8U; n; n--) {
-          SWD_WRITE_BIT(val);
-          val >>= 1;
-        }
-      }
-      SWD_WRITE_BIT(parity);      // write parity bit
-    }
-    // Idle cycles
-    n = idle_cycles;
-    if(n) {
-      SWD_SET(0);
-      for(; n; n--) SWD_CLOCK_CYCLE();
-    }
-    SWD_SET(1);
-    return(ack);
+  wait_count++;
+  n = wait_backoff;
+  if(n == 0U) return;
+  if(debug_port == DAP_PORT_JTAG) {
+    do {
+      JTAG_CYCLE_TCK();                           // Run-Test/Idle
+    } while(--n);
   }
-
-  if((ack == DAP_TRANSFER_WAIT) || (ack == DAP_TRANSFER_FAULT)) {
-    // Turnaround
-    SWD_CLOCK_CYCLE();
-    SWD_OUT_ENABLE();
+  else {
+    SWD_SET(0);
+    do {
+      SWD_CLOCK_CYCLE();                          // idle cycles
+    } while(--n);
     SWD_SET(1);
-    return(ack);
   }
+  if(wait_backoff <= (wait_backoff_max >> 1)) wait_backoff <<= 1;
+  else wait_backoff = wait_backoff_max;
+}
 
-  // Protocol error - clock out 32bits + parity + turnaround
-  n = 32U + 1U + 1U;
-  do {
-    SWD_CLOCK_CYCLE();            // back off data phase
-  } while(--n);
+uint8_t SWD_Transfer(uint8_t req, __xdata uint8_t *data) {
+  uint8_t ack;
+
+  if(DAP_clockDelay || (swd_conf & 0x03U)) ack = SWD_TransferSlow(req, data);
+  else ack = SWD_TransferFast(req, data);
+  if(ack == DAP_TRANSFER_WAIT) DAP_WaitBackoff();
+  return ack;
+}
+
+// ===================================================================================
+// SWD Line Reset (56 ones followed by idle cycles)
+// The ones alone are used where a select sequence must follow directly.
+// ===================================================================================
+void SWD_LineResetOnes(void) {
+  uint8_t n;
+
+  for(n = 7U; n; n--) SWD_WriteByte(0xFFU);
+}
+
+void SWD_LineReset(void) {
+  SWD_LineResetOnes();
+  SWD_WriteByte(0x00U);
+}
+
+// ===================================================================================
+// SWD Multi-drop Target Select (DPv2)
+// Line reset, TARGETSEL write (the ACK is not driven by any target and is ignored)
+// and DPIDR read, which is required to leave the lockout state.
+//   data:   TARGETSEL[31:0] (DPIDR[31:0] on return)
+//   return: ACK[2:0] of DPIDR read
+// ===================================================================================
+uint8_t SWD_TargetSelect(__xdata uint8_t *data) {
+  uint8_t parity;
+  uint8_t n;
 
+  // Line reset
+  SWD_LineReset();
+
+  // TARGETSEL packet request, turnaround + ACK + turnaround not driven
+  SWD_WriteByte(SWD_header[DP_TARGETSEL]);
+  SWD_OUT_DISABLE();
+  for(n = (swd_turnaround << 1) + 3U; n; n--) SWD_CLOCK_CYCLE();
   SWD_OUT_ENABLE();
-  SWD_SET(1);
-  return(ack);
+
+  // Write WDATA[0:31] + parity
+  parity = 0U;
+  for(n = 0; n < 4; n++) {
+    ACC = data[n];
+    if(P) parity++;
+    SWD_WriteByte(data[n]);
+  }
+  SWD_WriteBits(parity, 1U);
+
+  // Read DPIDR
+  return(SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, data));
 }
 
 // ===================================================================================
@@ -312,9 +487,7 @@ uint8_t SWD_Transfer(uint8_t req, __xdata uint8_t *data) {
 //   return: none
 // ===================================================================================
 void JTAG_Sequence (uint8_t info, const __xdata uint8_t *tdi, __xdata uint8_t *tdo) {
-  uint8_t i_val;
   uint8_t o_val;
-  uint8_t bit;
   uint8_t n, k;
 
   n = info & JTAG_SEQUENCE_TCK;
@@ -323,21 +496,15 @@ void JTAG_Sequence (uint8_t info, const __xdata uint8_t *tdi, __xdata uint8_t *t
   (info & JTAG_SEQUENCE_TMS) ? (TMS_SET(1)) : (TMS_SET(0));
 
   while(n) {
-    i_val = *tdi++;
-    o_val = 0U;
-    for (k = 8U; k && n; k--, n--) {
-      JTAG_CYCLE_TDIO(i_val, bit);
-      i_val >>= 1;
-      o_val >>= 1;
-      o_val  |= bit << 7;
-    }
-    o_val >>= k;
-    if(info & JTAG_SEQUENCE_TDO) *tdo++ = (uint8_t)o_val;
+    k = (n > 8U) ? 8U : n;
+    o_val = JTAG_ShiftBits(*tdi++, k);
+    n -= k;
+    if(info & JTAG_SEQUENCE_TDO) *tdo++ = o_val;
   }
 }
 
 // ===================================================================================
-// JTAG Set IR
+// JTAG Set IR (the last IR of each TAP is cached until the TAP state may change)
 //   ir:     IR value
 //   return: none
 // ===================================================================================
@@ -346,9 +513,16 @@ __idata uint8_t jtag_count;
 __xdata uint8_t jtag_ir_length[8];
 __xdata uint8_t jtag_ir_before[8];
 __xdata uint8_t jtag_ir_after[8];
+__xdata uint8_t jtag_ir_cache[8];
 static void JTAG_IR(uint8_t ir) {
   uint8_t n;
 
+  /* Skip scan if the TAP still holds the instruction */
+  n = 1U << jtag_index;
+  if((jtag_ir_valid & n) && (jtag_ir_cache[jtag_index] == ir)) return;
+  jtag_ir_valid = n;                        /* other TAPs are set to BYPASS */
+  jtag_ir_cache[jtag_index] = ir;
+
   TMS_SET(1);
   JTAG_CYCLE_TCK();                         /* Select-DR-Scan */
   JTAG_CYCLE_TCK();                         /* Select-IR-Scan */
@@ -393,9 +567,8 @@ static void JTAG_IR(uint8_t ir) {
 // ===================================================================================
 static uint8_t JTAG_Transfer(uint8_t req, __xdata uint8_t *data) {
   uint8_t ack;
-  uint8_t bit;
   uint8_t val;
-  uint8_t n, m;
+  uint8_t n;
 
   TMS_SET(1);
   JTAG_CYCLE_TCK();                         /* Select-DR-Scan */
@@ -403,16 +576,11 @@ static uint8_t JTAG_Transfer(uint8_t req, __xdata uint8_t *data) {
   JTAG_CYCLE_TCK();                         /* Capture-DR */
   JTAG_CYCLE_TCK();                         /* Shift-DR */
 
-  for(n = jtag_index; n; n--) {
-    JTAG_CYCLE_TCK();                       /* Bypass before data */
-  }
+  n = jtag_index;
+  if(n) JTAG_WriteBits(0xFF, n);            /* Bypass before data */
 
-  JTAG_CYCLE_TDIO(req >> 1, bit);           /* Set RnW, Get ACK.0 */
-  ack  = bit << 1;
-  JTAG_CYCLE_TDIO(req >> 2, bit);           /* Set A2,  Get ACK.1 */
-  ack |= bit << 0;
-  JTAG_CYCLE_TDIO(req >> 3, bit);           /* Set A3,  Get ACK.2 */
-  ack |= bit << 2;
+  val = JTAG_ShiftBits(req >> 1, 3U);       /* Set RnW, A2, A3, Get ACK.0..2 */
+  ack = ((val & 0x01) << 1) | ((val & 0x02) >> 1) | (val & 0x04);
 
   if(ack != DAP_TRANSFER_OK) {
     /* Exit on error */
@@ -421,67 +589,53 @@ static uint8_t JTAG_Transfer(uint8_t req, __xdata uint8_t *data) {
     goto exit;
   }
 
+  /* Capture timestamp */
+  if(req & DAP_TRANSFER_TIMESTAMP) DAP_Timestamp();
+
   if(req & DAP_TRANSFER_RnW) {
     /* Read Transfer */
-    val = 0U;
-    for(m = 0; m < 3; m++) {
-      for(n = 8U; n; n--) {
-        JTAG_CYCLE_TDO(bit);                /* Get D0..D23 */
-        val >>= 1;
-        if(bit) val |= 0x80;
-      }
-      if(data) data[m] = val;
+    if(data) {
+      data[0] = JTAG_ReadByte();            /* Get D0..D23 */
+      data[1] = JTAG_ReadByte();
+      data[2] = JTAG_ReadByte();
     }
-
-    val = 0U;
-    for(n = 7U; n; n--) {
-      JTAG_CYCLE_TDO(bit);                  /* Get D24..D30 */
-      if(bit) val |= 0x80;
-      val >>= 1;
+    else {
+      JTAG_ReadByte();
+      JTAG_ReadByte();
+      JTAG_ReadByte();
     }
+    val = JTAG_ReadBits(7U);                /* Get D24..D30 */
     n = jtag_count - jtag_index - 1U;
     if(n) {
-      JTAG_CYCLE_TDO(bit);                  /* Get D31 */
-      for(--n; n; n--) {
-        JTAG_CYCLE_TCK();                   /* Bypass after data */
-      }
+      val |= JTAG_ReadBits(1U) << 7;        /* Get D31 */
+      if(--n) JTAG_WriteBits(0xFF, n);      /* Bypass after data */
       TMS_SET(1);
       JTAG_CYCLE_TCK();                     /* Bypass & Exit1-DR */
     }
     else {
       TMS_SET(1);
-      JTAG_CYCLE_TDO(bit);                  /* Get D31 & Exit1-DR */
+      val |= JTAG_ReadBits(1U) << 7;        /* Get D31 & Exit1-DR */
     }
-    if(bit) val |= 0x80;
     if(data) data[3] = val;
   }
   else {
     /* Write Transfer */
-    for(m = 0; m < 3; m++) {
-      val = data[m];
-      for(n = 8U; n; n--) {
-        JTAG_CYCLE_TDI(val);                /* Set D0..D23 */
-        val >>= 1;
-      }
-    }
-
+    JTAG_WriteByte(data[0]);                /* Set D0..D23 */
+    JTAG_WriteByte(data[1]);
+    JTAG_WriteByte(data[2]);
     val = data[3];
-    for(n = 7U; n; n--) {
-      JTAG_CYCLE_TDI(val);                  /* Set D24..D30 */
-      val >>= 1;
-    }
+    JTAG_WriteBits(val, 7U);                /* Set D24..D30 */
+    val >>= 7;
     n = jtag_count - jtag_index - 1U;
     if(n) {
-      JTAG_CYCLE_TDI(val);                  /* Set D31 */
-      for(--n; n; n--) {
-        JTAG_CYCLE_TCK();                   /* Bypass after data */
-      }
+      JTAG_WriteBits(val, 1U);              /* Set D31 */
+      if(--n) JTAG_WriteBits(0xFF, n);      /* Bypass after data */
       TMS_SET(1);
       JTAG_CYCLE_TCK();                     /* Bypass & Exit1-DR */
     }
     else {
       TMS_SET(1);
-      JTAG_CYCLE_TDI(val);                  /* Set D31 & Exit1-DR */
+      JTAG_WriteBits(val, 1U);              /* Set D31 & Exit1-DR */
     }
   }
 
@@ -495,17 +649,61 @@ exit:
   n = idle_cycles;
   while(n--) JTAG_CYCLE_TCK();              /* Idle */
 
+  if(ack == DAP_TRANSFER_WAIT) DAP_WaitBackoff();
   return ack;
 }
 
+// ===================================================================================
+// JTAG Write ABORT register (ABORT instruction must be selected)
+//   data:   DATA[31:0]
+//   return: none
+// ===================================================================================
+static void JTAG_WriteAbort(__xdata uint8_t *data) {
+  uint8_t val;
+  uint8_t n;
+
+  TMS_SET(1);
+  JTAG_CYCLE_TCK();                         /* Select-DR-Scan */
+  TMS_SET(0);
+  JTAG_CYCLE_TCK();                         /* Capture-DR */
+  JTAG_CYCLE_TCK();                         /* Shift-DR */
+
+  n = jtag_index;
+  if(n) JTAG_WriteBits(0xFF, n);            /* Bypass before data */
+
+  JTAG_WriteBits(0x00, 3U);                 /* Set RnW=0 (Write), A2=0, A3=0 */
+
+  JTAG_WriteByte(data[0]);                  /* Set D0..D23 */
+  JTAG_WriteByte(data[1]);
+  JTAG_WriteByte(data[2]);
+  val = data[3];
+  JTAG_WriteBits(val, 7U);                  /* Set D24..D30 */
+  val >>= 7;
+  n = jtag_count - jtag_index - 1U;
+  if(n) {
+    JTAG_WriteBits(val, 1U);                /* Set D31 */
+    if(--n) JTAG_WriteBits(0xFF, n);        /* Bypass after data */
+    TMS_SET(1);
+    JTAG_CYCLE_TCK();                       /* Bypass & Exit1-DR */
+  }
+  else {
+    TMS_SET(1);
+    JTAG_WriteBits(val, 1U);                /* Set D31 & Exit1-DR */
+  }
+
+  JTAG_CYCLE_TCK();                         /* Update-DR */
+  TMS_SET(0);
+  JTAG_CYCLE_TCK();                         /* Idle */
+  TDI_SET(1);
+}
+
 // ===================================================================================
 // JTAG Read IDCODE register
 //   return: value read
 // ===================================================================================
 void JTAG_ReadIDCode(__xdata uint8_t *data) {
-  uint8_t bit;
   uint8_t val;
-  uint8_t n, m;
+  uint8_t n;
 
   TMS_SET(1);
   JTAG_CYCLE_TCK();                         /* Select-DR-Scan */
@@ -513,29 +711,16 @@ void JTAG_ReadIDCode(__xdata uint8_t *data) {
   JTAG_CYCLE_TCK();                         /* Capture-DR */
   JTAG_CYCLE_TCK();                         /* Shift-DR */
 
-  for(n = jtag_index; n; n--) {
-    JTAG_CYCLE_TCK();                       /* Bypass before data */
-  }
+  n = jtag_index;
+  if(n) JTAG_WriteBits(0xFF, n);            /* Bypass before data */
 
-  val = 0U;
-  for(m = 0; m < 3; m++) {
-    for(n = 8U; n; n--) {
-      JTAG_CYCLE_TDO(bit);                  /* Get D0..D23 */
-      val >>= 1;
-      if(bit) val |= 0x80;
-    }
-    data[m] = val;
-  }
-  val = 0U;
-  for(n = 7U; n; n--) {
-    JTAG_CYCLE_TDO(bit);                    /* Get D24..D30 */
-    if(bit) val |= 0x80;
-    val >>= 1;
-  }
+  data[0] = JTAG_ReadByte();                /* Get D0..D23 */
+  data[1] = JTAG_ReadByte();
+  data[2] = JTAG_ReadByte();
+  val = JTAG_ReadBits(7U);                  /* Get D24..D30 */
 
   TMS_SET(1);
-  JTAG_CYCLE_TDO(bit);                      /* Get D31 & Exit1-DR */
-  if(bit) val |= 0x80;
+  val |= JTAG_ReadBits(1U) << 7;            /* Get D31 & Exit1-DR */
   data[3] = val;
 
   JTAG_CYCLE_TCK();                         /* Update-DR */
@@ -546,16 +731,21 @@ void JTAG_ReadIDCode(__xdata uint8_t *data) {
 // ===================================================================================
 // Process SWJ Pins command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_SWJ_Pins(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_SWJ_Pins(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   uint8_t value;
   uint8_t select;
   uint16_t wait;
 
+  swd_shadow_valid = 0U;                          // pins may reset the target
   value = * (req + 0);
   select = (uint8_t) * (req + 1);
+  if(select & (DAP_SWJ_SWCLK_TCK_BIT | DAP_SWJ_SWDIO_TMS_BIT | DAP_SWJ_nTRST_BIT))
+    jtag_ir_valid = 0U;                           // TAP state may change
   wait = (uint16_t)(*(req + 2) << 0) | (uint16_t)(*(req + 3) << 8);
   if((uint8_t)(*(req + 4)) || (uint8_t)(*(req + 5))) wait |= 0x8000;
 
@@ -603,31 +793,94 @@ static uint8_t DAP_SWJ_Pins(const __xdata uint8_t *req, __xdata uint8_t *res) {
         | ((uint8_t)TRST_GET() << DAP_SWJ_nTRST)
         | ((uint8_t)RST_GET() << DAP_SWJ_nRESET);
   *res = value;
-  return 1;
+  return((6U << 8) | 1U);
+}
+
+// ===================================================================================
+// Process SWJ Clock command and prepare response
+// The fastest clock tier which does not exceed the requested clock is selected.
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+__data uint8_t DAP_clockDelay = 0U;
+__code uint32_t DAP_clockTierHz[] = {
+  DAP_CLOCK_HZ(0),   DAP_CLOCK_HZ(1),   DAP_CLOCK_HZ(2),   DAP_CLOCK_HZ(3),
+  DAP_CLOCK_HZ(5),   DAP_CLOCK_HZ(9),   DAP_CLOCK_HZ(17),  DAP_CLOCK_HZ(33),
+  DAP_CLOCK_HZ(65),  DAP_CLOCK_HZ(129), DAP_CLOCK_HZ(255)
+};
+__code uint8_t DAP_clockTierDelay[] = {
+  0, 1, 2, 3, 5, 9, 17, 33, 65, 129, 255
+};
+static uint16_t DAP_SWJ_Clock(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  uint32_t clock;
+  uint8_t tier;
+
+  clock = ((uint32_t)*(req + 0) <<  0)
+        | ((uint32_t)*(req + 1) <<  8)
+        | (uint32_t)(*(req + 2)) << 16
+        | (uint32_t)(*(req + 3)) << 24;
+
+  if(clock == 0U) {
+    *res = DAP_ERROR;
+    return((4U << 8) | 1U);
+  }
+
+  for(tier = 0; tier < sizeof(DAP_clockTierDelay) - 1; tier++) {
+    if(clock >= DAP_clockTierHz[tier]) break;
+  }
+  DAP_clockDelay = DAP_clockTierDelay[tier];
+
+  *res = DAP_OK;
+  return((4U << 8) | 1U);
 }
 
 // ===================================================================================
 // Process SWJ Sequence command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_SWJ_Sequence(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_SWJ_Sequence(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   uint8_t count;
   count = *req++;
   if(count == 0U) count = 255U;
   SWJ_Sequence(count, req);
+  swd_shadow_valid = 0U;                          // line reset
+  jtag_ir_valid = 0U;                             // TAP reset
   *res = DAP_OK;
-  return 1;
+  return(((uint16_t)(((count + 7U) >> 3) + 1U) << 8) | 1U);
+}
+
+// ===================================================================================
+// Process SWD Configure command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_SWD_Configure(const __xdata uint8_t *req) {
+  swd_conf       = *req & 0x07U;
+  swd_turnaround = (swd_conf & 0x03U) + 1U;       // 1..4 cycles
+  swd_data_phase = (swd_conf & 0x04U) ? 1U : 0U;  // data phase on WAIT/FAULT
+  if(orun_detect) swd_data_phase = 1U;            // required by overrun detection
+  *DAP_response = DAP_OK;
+  return((1U << 8) | 1U);
 }
 
 // ===================================================================================
 // Process SWD Sequence command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_SWD_Sequence(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_SWD_Sequence(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   uint8_t sequence_info;
   uint8_t sequence_count;
   uint8_t request_count;
@@ -638,6 +891,7 @@ static uint8_t DAP_SWD_Sequence(const __xdata uint8_t *req, __xdata uint8_t *res
   request_count = 1U;
   response_count = 1U;
   sequence_count = *req++;
+  swd_shadow_valid = 0U;                          // line reset or target select
 
   while(sequence_count--) {
     sequence_info = *req++;
@@ -658,17 +912,18 @@ static uint8_t DAP_SWD_Sequence(const __xdata uint8_t *req, __xdata uint8_t *res
       request_count += count + 1U;
     }
   }
-  return response_count;
+  return(((uint16_t)request_count << 8) | response_count);
 }
 
 // ===================================================================================
 // Process JTAG Sequence command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response (lower 16 bits)
-//             number of bytes in request (upper 16 bits)
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_JTAG_Sequence(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_JTAG_Sequence(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   uint8_t sequence_info;
   uint8_t sequence_count;
   uint8_t request_count;
@@ -676,6 +931,7 @@ static uint8_t DAP_JTAG_Sequence(const __xdata uint8_t *req, __xdata uint8_t *re
   uint8_t count;
 
   *res++ = DAP_OK;
+  jtag_ir_valid = 0U;                             // TAP state may change
   request_count  = 1U;
   response_count = 1U;
   sequence_count = *req++;
@@ -693,25 +949,29 @@ static uint8_t DAP_JTAG_Sequence(const __xdata uint8_t *req, __xdata uint8_t *re
       response_count += count;
     }
   }
-  return response_count;
+  return(((uint16_t)request_count << 8) | response_count);
 }
 
 // ===================================================================================
 // Process JTAG Configure command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response (lower 16 bits)
-//             number of bytes in request (upper 16 bits)
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_JTAG_Configure(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_JTAG_Configure(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  uint8_t request_count;
   uint8_t count;
   uint8_t length;
   uint8_t bits;
   uint8_t n;
 
   count = *req++;
+  request_count = count + 1U;
   if(count > 8) count = 8;
   jtag_count = count;
+  jtag_ir_valid = 0U;
 
   bits = 0U;
   for(n = 0U; n < count; n++) {
@@ -726,18 +986,18 @@ static uint8_t DAP_JTAG_Configure(const __xdata uint8_t *req, __xdata uint8_t *r
   }
 
   *res = DAP_OK;
-  return 1;
+  return(((uint16_t)request_count << 8) | 1U);
 }
 
 // ===================================================================================
 // Process JTAG IDCODE command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response (lower 16 bits)
-//             number of bytes in request (upper 16 bits)
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-__xdata uint8_t data[4];
-static uint8_t DAP_JTAG_IDCode(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_JTAG_IDCode(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   if(debug_port != DAP_PORT_JTAG) goto id_error;
 
   // Device index (JTAP TAP)
@@ -747,58 +1007,291 @@ static uint8_t DAP_JTAG_IDCode(const __xdata uint8_t *req, __xdata uint8_t *res)
   // Select JTAG chain
   JTAG_IR(JTAG_IDCODE);
 
-  // Read IDCODE register
-  JTAG_ReadIDCode(data);
-
-  // Store Data
+  // Read IDCODE register into response
+  JTAG_ReadIDCode(res + 1);
   *(res+0) =  DAP_OK;
-  *(res+1) = (uint8_t)(data[0]);
-  *(res+2) = (uint8_t)(data[1]);
-  *(res+3) = (uint8_t)(data[2]);
-  *(res+4) = (uint8_t)(data[3]);
 
-  return 5;
+  return((1U << 8) | 5U);
 
 id_error:
   *res = DAP_ERROR;
-  return 1;
+  return((1U << 8) | 1U);
+}
+
+// ===================================================================================
+// Skip Transfer requests which were canceled or can not be processed
+//   request: pointer to first request to skip
+//   count:   number of requests to skip
+//   return:  pointer behind last skipped request
+// ===================================================================================
+static const __xdata uint8_t *DAP_SkipTransfer(const __xdata uint8_t *req, uint8_t count) {
+  uint8_t value;
+  for(; count != 0U; count--) {
+    value = *req++;
+    if(((value & DAP_TRANSFER_RnW) == 0U) || ((value & DAP_TRANSFER_MATCH_VALUE) != 0U))
+      req += 4;                                   // write data or match value
+  }
+  return req;
 }
 
 // ===================================================================================
 // Process Transfer Configure command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
 __idata uint16_t retry_count;
-__idata uint16_t match_retry;
-static uint8_t DAP_TransferConfigure(const __xdata uint8_t *req, __xdata uint8_t *res) {
+__idata uint16_t match_retry_count;
+static uint16_t DAP_TransferConfigure(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   idle_cycles = *(req + 0);
   retry_count = (uint16_t) * (req + 1)
               | (uint16_t)(*(req + 2) << 8);
-  match_retry = (uint16_t) * (req + 3)
-              | (uint16_t)(*(req + 4) << 8);
+  match_retry_count = (uint16_t) * (req + 3)
+                    | (uint16_t)(*(req + 4) << 8);
   *res = DAP_OK;
-  return 1;
+  return((5U << 8) | 1U);
 }
 
 // ===================================================================================
-// Process SWD Transfer command and prepare response
-//   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+// Transfer state (shared by Transfer and Transfer Block commands)
 // ===================================================================================
 __idata uint8_t match_mask[4];
 __idata uint8_t match_value[4];
-__idata uint8_t DAP_TransferAbort = 0U;
+volatile __idata uint8_t DAP_TransferAbort = 0U;
 __idata uint8_t request_count;
 __idata uint8_t request_value;
 __idata uint8_t response_count;
 __idata uint8_t response_value;
 __idata uint16_t retry;
-static uint8_t DAP_SWD_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res) {
+__idata uint16_t match_retry;
+__xdata uint8_t data[4];                          // match/abort scratch word
+
+// Start transfer batch (reset abort flag and WAIT statistics)
+static void DAP_TransferStart(void) {
+  DAP_TransferAbort = 0U;
+  wait_count = 0U;
+  wait_backoff = wait_backoff_init;
+}
+
+// ===================================================================================
+// Clear sticky errors after FAULT response (if enabled by DAP_OPTION_STICKY_CLEAR)
+// and mark this in the response value
+// ===================================================================================
+__xdata uint8_t sticky_clear = 0U;
+static void DAP_SWD_ClearSticky(void) {
+  if((response_value == DAP_TRANSFER_FAULT) && sticky_clear) {
+    data[0] = DP_ABORT_STKCMPCLR | DP_ABORT_STKERRCLR
+            | DP_ABORT_WDERRCLR  | DP_ABORT_ORUNERRCLR;
+    data[1] = 0U;
+    data[2] = 0U;
+    data[3] = 0U;
+    SWD_Transfer(DP_ABORT, data);
+    response_value |= DAP_TRANSFER_CLEARED;
+  }
+}
+
+// ===================================================================================
+// Read register until its value matches or match retry counter expires
+// The read is repeated on WAIT, the masked value is compared in one pass with early
+// exit. An optional back-off (DAP_OPTION_MATCH_BACKOFF) is inserted between polls.
+// The function is generated for each port (DAP_SWD_TransferMatch and
+// DAP_JTAG_TransferMatch), so the poll loop calls the transfer function directly.
+//   req:    transfer request (read of posted AP/JTAG register or of DP register)
+//   return: response value (DAP_TRANSFER_MISMATCH set if value did not match)
+// ===================================================================================
+__xdata uint16_t match_backoff = 0U;
+#define DAP_TransferMatchFunction(port)                                             \
+static uint8_t DAP_##port##_TransferMatch(uint8_t req) {                            \
+  uint8_t n;                                                                        \
+                                                                                    \
+  match_retry = match_retry_count;                                                  \
+  do {                                                                              \
+    retry = retry_count;                                                            \
+    do {                                                                            \
+      response_value = port##_Transfer(req, data);                                  \
+    } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort); \
+    if(response_value != DAP_TRANSFER_OK) return response_value;                    \
+                                                                                    \
+    for(n = 0; n < 4; n++) {                                                        \
+      if((data[n] & match_mask[n]) != match_value[n]) break;                        \
+    }                                                                               \
+    if(n == 4) return response_value;             /* value matches */               \
+                                                                                    \
+    if(match_backoff) DLY_us(match_backoff);      /* back-off between polls */      \
+  } while(match_retry-- && !DAP_TransferAbort);                                     \
+                                                                                    \
+  return(response_value | DAP_TRANSFER_MISMATCH);                                   \
+}
+
+DAP_TransferMatchFunction(SWD)
+DAP_TransferMatchFunction(JTAG)
+
+// ===================================================================================
+// Repeat SWD transfer while WAIT is responded (slow path)
+//   req:    transfer request
+//   data:   DATA[31:0]
+//   return: none (result in response_value)
+// ===================================================================================
+static void DAP_SWD_TransferRetry(uint8_t req, __xdata uint8_t *data) {
+  retry = retry_count;
+  while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort)
+    response_value = SWD_Transfer(req, data);
+}
+
+// ===================================================================================
+// SWD overrun detection write mode (DAP_OPTION_ORUN_DETECT)
+// ORUNDETECT is set in CTRL/STAT, writes are streamed without WAIT retries and the
+// sticky flags are checked at the end of a write batch, also if a write failed with
+// WAIT or FAULT. A data phase is required on WAIT/FAULT in this mode.
+// ===================================================================================
+
+// Enable/disable overrun detection (read-modify-write of CTRL/STAT)
+static uint8_t DAP_SWD_SetOverrun(uint8_t on) {
+  if(debug_port != DAP_PORT_SWD) return DAP_TRANSFER_ERROR;
+  response_value = SWD_Transfer(DP_CTRL_STAT | DAP_TRANSFER_RnW, data);
+  DAP_SWD_TransferRetry(DP_CTRL_STAT | DAP_TRANSFER_RnW, data);
+  if(response_value != DAP_TRANSFER_OK) return response_value;
+
+  if(on) data[0] |=  DP_CTRL_ORUNDETECT;
+  else   data[0] &= ~DP_CTRL_ORUNDETECT;
+  response_value = SWD_Transfer(DP_CTRL_STAT, data);
+  DAP_SWD_TransferRetry(DP_CTRL_STAT, data);
+  if(response_value != DAP_TRANSFER_OK) return response_value;
+
+  orun_detect    = on;
+  swd_data_phase = (on || (swd_conf & 0x04U)) ? 1U : 0U;
+  return DAP_TRANSFER_OK;
+}
+
+// Check sticky flags at the end of a write batch (RDBUFF read completes the last
+// posted write, CTRL/STAT reads are not stalled by it). The response value of the
+// batch is kept unless a sticky flag is set or a check read fails.
+static void DAP_SWD_CheckOverrun(void) {
+  uint8_t ack;
+
+  ack = response_value;
+  retry = retry_count;
+  do {
+    response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
+  } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+  if(response_value != DAP_TRANSFER_OK) ack = response_value;
+
+  response_value = SWD_Transfer(DP_CTRL_STAT | DAP_TRANSFER_RnW, data);
+  DAP_SWD_TransferRetry(DP_CTRL_STAT | DAP_TRANSFER_RnW, data);
+  if(response_value != DAP_TRANSFER_OK) return;
+  if(data[0] & (DP_CTRL_STICKYORUN | DP_CTRL_STICKYERR))
+    response_value = DAP_TRANSFER_FAULT;
+  else
+    response_value = ack;
+}
+
+// ===================================================================================
+// Check last write of a batch (RDBUFF read or sticky flags in overrun detection mode)
+// Called after every write batch with its response value. In overrun detection mode
+// the sticky flags are also checked after WAIT and FAULT, protocol and parity errors
+// are kept.
+// ===================================================================================
+static void DAP_SWD_CheckWrite(void) {
+  if(orun_detect) {
+    if((response_value == DAP_TRANSFER_OK)   ||
+       (response_value == DAP_TRANSFER_WAIT) ||
+       (response_value == DAP_TRANSFER_FAULT))
+      DAP_SWD_CheckOverrun();
+    return;
+  }
+  if(response_value != DAP_TRANSFER_OK) return;
+  retry = retry_count;
+  do {
+    response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
+  } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+}
+
+// ===================================================================================
+// SELECT/CSW/TAR shadow cache (SWD)
+// Holds the last written DP SELECT and, if APBANKSEL is 0, CSW and TAR of the selected
+// AP. Redundant writes complete locally. Power requests written to CTRL/STAT are
+// tracked for multi-drop target switching. TAR is dropped on DRW accesses (address
+// auto-increment), everything on line reset, fault, target reset and disconnect.
+//   req:    transfer request (write)
+//   data:   DATA[31:0]
+//   return: 1 if register already holds the value, 0 if it has to be written
+// ===================================================================================
+#define SHADOW_SELECT   (1U << 0)
+#define SHADOW_CSW      (1U << 1)
+#define SHADOW_TAR      (1U << 2)
+#define SHADOW_BANK0    (1U << 3)                 // selected APBANKSEL is 0
+#define SHADOW_ADDR     (DAP_TRANSFER_APnDP | DAP_TRANSFER_A2 | DAP_TRANSFER_A3)
+#define SHADOW_TAR_REQ  (DAP_TRANSFER_APnDP | AP_TAR)
+#define SHADOW_DRW      (DAP_TRANSFER_APnDP | AP_DRW)
+
+__xdata uint8_t swd_shadow[3][4];
+__xdata uint8_t swd_power = 0U;                   // requested power state CTRL/STAT[31:24]
+static uint8_t DAP_SWD_ShadowWrite(uint8_t req, const __xdata uint8_t *data) {
+  __xdata uint8_t *shadow;
+  uint8_t flag;
+  uint8_t n;
+
+  switch(req & SHADOW_ADDR) {
+    case DP_SELECT:
+      shadow = swd_shadow[0];
+      flag   = SHADOW_SELECT;
+      break;
+    case DAP_TRANSFER_APnDP | AP_CSW:
+      if(!(swd_shadow_valid & SHADOW_BANK0)) return 0U;
+      shadow = swd_shadow[1];
+      flag   = SHADOW_CSW;
+      break;
+    case SHADOW_TAR_REQ:
+      if(!(swd_shadow_valid & SHADOW_BANK0)) return 0U;
+      shadow = swd_shadow[2];
+      flag   = SHADOW_TAR;
+      break;
+    case SHADOW_DRW:
+      swd_shadow_valid &= ~SHADOW_TAR;
+      return 0U;
+    case DP_CTRL_STAT:                            // track power requests (DPBANKSEL 0)
+      if((swd_shadow_valid & SHADOW_SELECT) && !(swd_shadow[0][0] & 0x0FU))
+        swd_power = data[3] & DP_CTRL_PWRUPREQ_B3;
+      return 0U;
+    default:
+      return 0U;
+  }
+
+  if(swd_shadow_valid & flag) {
+    for(n = 0; n < 4; n++) {
+      if(shadow[n] != data[n]) break;
+    }
+    if(n == 4) return 1U;                         // redundant write
+  }
+
+  // Update shadow (a failed write invalidates the cache at the end of the transfer)
+  shadow[0] = data[0];
+  shadow[1] = data[1];
+  shadow[2] = data[2];
+  shadow[3] = data[3];
+  if(flag == SHADOW_SELECT) {
+    swd_shadow_valid = SHADOW_SELECT;             // AP or bank changed: drop CSW/TAR
+    if(!(data[0] & 0xF0U) && !data[1] && !data[2]) swd_shadow_valid |= SHADOW_BANK0;
+  }
+  else swd_shadow_valid |= flag;
+  return 0U;
+}
+
+// ===================================================================================
+// Process SWD Transfer command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_SWD_Transfer(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   const __xdata uint8_t *request_head;
+  const __xdata uint8_t *request_start;
   __xdata uint8_t *response_head;
+  __xdata uint8_t *rdata;
   uint8_t post_read;
   uint8_t check_write;
 
@@ -807,41 +1300,44 @@ static uint8_t DAP_SWD_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res
   response_value = 0U;
   response_head = res;
   res += 2;
-  DAP_TransferAbort = 0U;
+  DAP_TransferStart();
   post_read = 0U;
   check_write = 0U;
 
   req++;                                          // ignore DAP index
   request_count = *req++;
   for(; request_count != 0U; request_count--) {
+    request_start = req;
     request_value = *req++;
 
     // RnW == 1 for read, 0 for write
     if(request_value & DAP_TRANSFER_RnW) {
-      // Read registers
+      // Read registers (DRW read increments TAR)
+      if((request_value & SHADOW_ADDR) == SHADOW_DRW) swd_shadow_valid &= ~SHADOW_TAR;
       if(post_read) {
         // Read was posted before
         retry = retry_count;
         if((request_value & (DAP_TRANSFER_APnDP | DAP_TRANSFER_MATCH_VALUE)) == DAP_TRANSFER_APnDP) {
           // Read previous AP data and post next AP read
           do {
-            response_value = SWD_Transfer(request_value, data);
+            response_value = SWD_Transfer(request_value, res);
           } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
         }
         else {
           // Read previous AP data
           do {
-            response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+            response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, res);
           } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
           post_read = 0U;
         }
         if(response_value != DAP_TRANSFER_OK) break;
 
         // Store previous AP data
-        *res++ = (uint8_t)data[0];
-        *res++ = (uint8_t)data[1];
-        *res++ = (uint8_t)data[2];
-        *res++ = (uint8_t)data[3];
+        res += 4;
+
+        // Store timestamp of next AP read
+        if(post_read && (request_value & DAP_TRANSFER_TIMESTAMP))
+          res = DAP_PutTimestamp(res);
       }
       if((request_value & DAP_TRANSFER_MATCH_VALUE) != 0U) {
         // Read with value match
@@ -850,7 +1346,6 @@ static uint8_t DAP_SWD_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res
         match_value[2] = (uint8_t)(*(req + 2));
         match_value[3] = (uint8_t)(*(req + 3));
         req += 4;
-        match_retry = match_retry;
         if((request_value & DAP_TRANSFER_APnDP) != 0U) {
           // Post AP read
           retry = retry_count;
@@ -859,24 +1354,8 @@ static uint8_t DAP_SWD_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res
           } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
           if(response_value != DAP_TRANSFER_OK) break;
         }
-        do {
-          // Read registers until its value matches or retry counter expires
-          retry = retry_count;
-          do {
-            response_value = SWD_Transfer(request_value, data);
-          } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-          if(response_value != DAP_TRANSFER_OK) break;
-        }
-        while(((data[0] & match_mask[0]) != match_value[0] ||
-               (data[1] & match_mask[1]) != match_value[1] ||
-               (data[2] & match_mask[2]) != match_value[2] ||
-               (data[3] & match_mask[3]) != match_value[3]) &&
-                match_retry-- && !DAP_TransferAbort);
-        if((data[0] & match_mask[0]) != match_value[0] ||
-           (data[1] & match_mask[1]) != match_value[1] ||
-           (data[2] & match_mask[2]) != match_value[2] ||
-           (data[3] & match_mask[3]) != match_value[3])
-               response_value |= DAP_TRANSFER_MISMATCH;
+        // Read registers until its value matches or retry counter expires
+        response_value = DAP_SWD_TransferMatch(request_value);
         if(response_value != DAP_TRANSFER_OK) break;
       }
       else {
@@ -890,21 +1369,22 @@ static uint8_t DAP_SWD_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res
               response_value = SWD_Transfer(request_value, NULL);
             } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
             if(response_value != DAP_TRANSFER_OK) break;
+            // Store timestamp
+            if(request_value & DAP_TRANSFER_TIMESTAMP) res = DAP_PutTimestamp(res);
             post_read = 1U;
           }
         }
         else {
-          // Read DP register
+          // Read DP register (data goes behind the timestamp)
+          rdata = (request_value & DAP_TRANSFER_TIMESTAMP) ? res + 4 : res;
           do {
-            response_value = SWD_Transfer(request_value, data);
+            response_value = SWD_Transfer(request_value, rdata);
           } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
           if(response_value != DAP_TRANSFER_OK) break;
 
-          // Store data
-          *res++ = data[0];
-          *res++ = data[1];
-          *res++ = data[2];
-          *res++ = data[3];
+          // Store timestamp and data
+          if(request_value & DAP_TRANSFER_TIMESTAMP) res = DAP_PutTimestamp(res);
+          res += 4;
         }
       }
       check_write = 0U;
@@ -915,95 +1395,85 @@ static uint8_t DAP_SWD_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res
         // Read previous data
         retry = retry_count;
         do {
-          response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+          response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, res);
         } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
         if(response_value != DAP_TRANSFER_OK) break;
 
         // Store previous data
-        *res++ = data[0];
-        *res++ = data[1];
-        *res++ = data[2];
-        *res++ = data[3];
+        res += 4;
         post_read = 0U;
       }
-      // Load data
-      data[0] = (uint8_t)(*(req + 0));
-      data[1] = (uint8_t)(*(req + 1));
-      data[2] = (uint8_t)(*(req + 2));
-      data[3] = (uint8_t)(*(req + 3));
-      req += 4;
       if((request_value & DAP_TRANSFER_MATCH_MASK) != 0U) {
         // Write match mask
-        match_mask[0] = data[0];
-        match_mask[1] = data[1];
-        match_mask[2] = data[2];
-        match_mask[3] = data[3];
+        match_mask[0] = (uint8_t)(*(req + 0));
+        match_mask[1] = (uint8_t)(*(req + 1));
+        match_mask[2] = (uint8_t)(*(req + 2));
+        match_mask[3] = (uint8_t)(*(req + 3));
         response_value = DAP_TRANSFER_OK;
       }
       else {
-        // Write DP/AP register
-        retry = retry_count;
-        do {
-          response_value = SWD_Transfer(request_value, data);
-        } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-        if(response_value != DAP_TRANSFER_OK) break;
-        check_write = 1U;
+        // Skip redundant SELECT/CSW/TAR write (unless timestamp is requested)
+        if(DAP_SWD_ShadowWrite(request_value, req)
+           && !(request_value & DAP_TRANSFER_TIMESTAMP)) {
+          response_value = DAP_TRANSFER_OK;
+        }
+        else {
+          // Write DP/AP register (no retry in overrun detection mode)
+          response_value = SWD_Transfer(request_value, (__xdata uint8_t *)req);
+          check_write = 1U;
+          if((response_value != DAP_TRANSFER_OK) && !orun_detect)
+            DAP_SWD_TransferRetry(request_value, (__xdata uint8_t *)req);
+          if(response_value != DAP_TRANSFER_OK) break;
+          // Store timestamp
+          if(request_value & DAP_TRANSFER_TIMESTAMP) res = DAP_PutTimestamp(res);
+        }
       }
+      req += 4;
     }
     response_count++;
     if(DAP_TransferAbort) break;
   }
 
-  for(; request_count != 0U; request_count--) {
-    // Process canceled requests
-    request_value = *req++;
-    if((request_value & DAP_TRANSFER_RnW) != 0U) {  // Read register
-      if((request_value & DAP_TRANSFER_MATCH_VALUE) != 0U) req += 4;
-    }
-    else req += 4;                                  // Write register
-  }
+  // Process canceled requests
+  if(request_count) req = DAP_SkipTransfer(request_start, request_count);
 
-  if(response_value == DAP_TRANSFER_OK) {
-    if(post_read) {
-      // Read previous data
-      retry = retry_count;
-      do {
-        response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
-      } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-      if(response_value != DAP_TRANSFER_OK) goto end;
+  if(post_read && (response_value == DAP_TRANSFER_OK)) {
+    // Read previous data
+    retry = retry_count;
+    do {
+      response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, res);
+    } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+    if(response_value != DAP_TRANSFER_OK) goto end;
 
-      // Store previous data
-      *res++ = (uint8_t)data[0];
-      *res++ = (uint8_t)data[1];
-      *res++ = (uint8_t)data[2];
-      *res++ = (uint8_t)data[3];
-    }
-    else if(check_write) {
-      // Check last write
-      retry = retry_count;
-      do {
-        response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
-      } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-    }
+    // Store previous data
+    res += 4;
+  }
+  else if(check_write) {
+    // Check last write (or overrun)
+    DAP_SWD_CheckWrite();
   }
 
 end:
+  if(response_value != DAP_TRANSFER_OK) swd_shadow_valid = 0U;
+  DAP_SWD_ClearSticky();
   *(response_head + 0) = (uint8_t)response_count;
   *(response_head + 1) = (uint8_t)response_value;
-  return((uint8_t)(res - response_head));
+  return(((uint16_t)(uint8_t)(req - request_head) << 8) | (uint8_t)(res - response_head));
 }
 
 // ===================================================================================
 // Process JTAG Transfer command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response (lower 16 bits)
-//             number of bytes in request (upper 16 bits)
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
 __idata uint8_t request_ir;
 __idata uint8_t ir;
-static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_JTAG_Transfer(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
   const __xdata uint8_t *request_head;
+  const __xdata uint8_t *request_start;
   __xdata uint8_t *response_head;
   uint8_t  post_read;
 
@@ -1012,16 +1482,18 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
   response_value = 0U;
   response_head  = res;
   res += 2;
-  DAP_TransferAbort = 0U;
+  DAP_TransferStart();
   ir        = 0U;
   post_read = 0U;
 
   // Device index (JTAP TAP)
   jtag_index = *req++;
-  if(jtag_index >= jtag_count) goto end;
   request_count = *req++;
+  request_start = req;
+  if(jtag_index >= jtag_count) goto cancel;
 
   for(; request_count != 0U; request_count--) {
+    request_start = req;
     request_value = *req++;
     request_ir = (request_value & DAP_TRANSFER_APnDP) ? JTAG_APACC : JTAG_DPACC;
     if((request_value & DAP_TRANSFER_RnW) != 0U) {
@@ -1032,7 +1504,7 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
         if((ir == request_ir) && ((request_value & DAP_TRANSFER_MATCH_VALUE) == 0U)) {
           // Read previous data and post next read
           do {
-            response_value = JTAG_Transfer(request_value, data);
+            response_value = JTAG_Transfer(request_value, res);
           } while ((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
         }
         else {
@@ -1043,17 +1515,18 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
           }
           // Read previous data
           do {
-            response_value = JTAG_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+            response_value = JTAG_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, res);
           } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
           post_read = 0U;
         }
         if(response_value != DAP_TRANSFER_OK) break;
 
         // Store previous data
-        *res++ = (uint8_t)data[0];
-        *res++ = (uint8_t)data[1];
-        *res++ = (uint8_t)data[2];
-        *res++ = (uint8_t)data[3];
+        res += 4;
+
+        // Store timestamp of next read
+        if(post_read && (request_value & DAP_TRANSFER_TIMESTAMP))
+          res = DAP_PutTimestamp(res);
       }
       if((request_value & DAP_TRANSFER_MATCH_VALUE) != 0U) {
         // Read with value match
@@ -1062,7 +1535,6 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
         match_value[2] = (uint8_t)(*(req + 2));
         match_value[3] = (uint8_t)(*(req + 3));
         req += 4;
-        match_retry = match_retry;
         // Select JTAG chain
         if(ir != request_ir) {
           ir = request_ir;
@@ -1074,24 +1546,8 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
           response_value = JTAG_Transfer(request_value, NULL);
         } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
         if(response_value != DAP_TRANSFER_OK) break;
-        do {
-          // Read register until its value matches or retry counter expires
-          retry = retry_count;
-          do {
-            response_value = JTAG_Transfer(request_value, data);
-          } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-          if(response_value != DAP_TRANSFER_OK) break;
-        } 
-        while(((data[0] & match_mask[0]) != match_value[0] ||
-               (data[1] & match_mask[1]) != match_value[1] ||
-               (data[2] & match_mask[2]) != match_value[2] ||
-               (data[3] & match_mask[3]) != match_value[3]) &&
-                match_retry-- && !DAP_TransferAbort);
-        if((data[0] & match_mask[0]) != match_value[0] ||
-           (data[1] & match_mask[1]) != match_value[1] ||
-           (data[2] & match_mask[2]) != match_value[2] ||
-           (data[3] & match_mask[3]) != match_value[3])
-               response_value |= DAP_TRANSFER_MISMATCH;
+        // Read register until its value matches or retry counter expires
+        response_value = DAP_JTAG_TransferMatch(request_value);
         if(response_value != DAP_TRANSFER_OK) break;
       }
       else {
@@ -1108,6 +1564,8 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
             response_value = JTAG_Transfer(request_value, NULL);
           } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
           if (response_value != DAP_TRANSFER_OK) break;
+          // Store timestamp
+          if(request_value & DAP_TRANSFER_TIMESTAMP) res = DAP_PutTimestamp(res);
           post_read = 1U;
         }
       }
@@ -1123,29 +1581,20 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
         // Read previous data
         retry = retry_count;
         do {
-          response_value = JTAG_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+          response_value = JTAG_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, res);
         } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
         if(response_value != DAP_TRANSFER_OK) break;
 
         // Store previous data
-        *res++ = data[0];
-        *res++ = data[1];
-        *res++ = data[2];
-        *res++ = data[3];
+        res += 4;
         post_read = 0U;
       }
-      // Load data
-      data[0] = (uint8_t)(*(req + 0));
-      data[1] = (uint8_t)(*(req + 1));
-      data[2] = (uint8_t)(*(req + 2));
-      data[3] = (uint8_t)(*(req + 3));
-      req += 4;
-      if ((request_value & DAP_TRANSFER_MATCH_MASK) != 0U) {
+      if((request_value & DAP_TRANSFER_MATCH_MASK) != 0U) {
         // Write match mask
-        match_mask[0] = data[0];
-        match_mask[1] = data[1];
-        match_mask[2] = data[2];
-        match_mask[3] = data[3];
+        match_mask[0] = (uint8_t)(*(req + 0));
+        match_mask[1] = (uint8_t)(*(req + 1));
+        match_mask[2] = (uint8_t)(*(req + 2));
+        match_mask[3] = (uint8_t)(*(req + 3));
         response_value = DAP_TRANSFER_OK;
       } 
       else {
@@ -1157,24 +1606,21 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
         // Write DP/AP register
         retry = retry_count;
         do {
-          response_value = JTAG_Transfer(request_value, data);
+          response_value = JTAG_Transfer(request_value, (__xdata uint8_t *)req);
         } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
         if(response_value != DAP_TRANSFER_OK) break;
+        // Store timestamp
+        if(request_value & DAP_TRANSFER_TIMESTAMP) res = DAP_PutTimestamp(res);
       }
+      req += 4;
     }
     response_count++;
     if(DAP_TransferAbort) break;
   }
 
-  for (; request_count != 0U; request_count--) {
-    // Process canceled requests
-    request_value = *req++;
-    if((request_value & DAP_TRANSFER_RnW) != 0U) {
-      // Read register
-      if((request_value & DAP_TRANSFER_MATCH_VALUE) != 0U) req += 4;
-    }
-    else req += 4;                 // Write register
-  }
+cancel:
+  // Process canceled requests
+  if(request_count) req = DAP_SkipTransfer(request_start, request_count);
 
   if(response_value == DAP_TRANSFER_OK) {
     // Select JTAG chain
@@ -1186,15 +1632,12 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
       // Read previous data
       retry = retry_count;
       do {
-        response_value = JTAG_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data);
+        response_value = JTAG_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, res);
       } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
       if(response_value != DAP_TRANSFER_OK) goto end;
 
       // Store previous data
-      *res++ = (uint8_t)data[0];
-      *res++ = (uint8_t)data[1];
-      *res++ = (uint8_t)data[2];
-      *res++ = (uint8_t)data[3];
+      res += 4;
     }
     else {
       // Check last write
@@ -1208,22 +1651,96 @@ static uint8_t DAP_JTAG_Transfer(const __xdata uint8_t *req, __xdata uint8_t *re
 end:
   *(response_head+0) = (uint8_t)response_count;
   *(response_head+1) = (uint8_t)response_value;
-  return((uint8_t)(res - response_head));
+  return(((uint16_t)(uint8_t)(req - request_head) << 8) | (uint8_t)(res - response_head));
+}
+
+// ===================================================================================
+// Get request size of Transfer Block command
+//   request:  pointer to request data
+//   num:      number of bytes in response
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_TransferBlockSize(const __xdata uint8_t *req, uint8_t num) {
+  if((*(req + 3) & DAP_TRANSFER_RnW) != 0U)
+    return((4U << 8) | num);                      // read register block
+  return(((uint16_t)(4U + (*(req + 1) << 2)) << 8) | num); // write register block
+}
+
+// ===================================================================================
+// Read SWD register block (request_count > 0 reads of request_value, streaming while
+// all ACKs are OK, AP reads are posted and the last AP data is read from RDBUFF)
+//   res:    pointer to response data
+//   return: pointer behind the read data (result in response_value)
+// ===================================================================================
+static __xdata uint8_t *DAP_SWD_ReadBlock(__xdata uint8_t *res) {
+  if((request_value & DAP_TRANSFER_APnDP) != 0U) {
+    // Post AP read
+    retry = retry_count;
+    do {
+      response_value = SWD_Transfer(request_value, NULL);
+    } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+    if(response_value != DAP_TRANSFER_OK) return res;
+  }
+  while(--request_count) {
+    response_value = SWD_Transfer(request_value, res);
+    if(response_value != DAP_TRANSFER_OK) {
+      DAP_SWD_TransferRetry(request_value, res);
+      if(response_value != DAP_TRANSFER_OK) return res;
+    }
+    res += 4;
+    response_count++;
+  }
+
+  // Last read (AP data from RDBUFF)
+  if((request_value & DAP_TRANSFER_APnDP) != 0U)
+    request_value = DP_RDBUFF | DAP_TRANSFER_RnW;
+  response_value = SWD_Transfer(request_value, res);
+  if(response_value != DAP_TRANSFER_OK) {
+    DAP_SWD_TransferRetry(request_value, res);
+    if(response_value != DAP_TRANSFER_OK) return res;
+  }
+  response_count++;
+  return(res + 4);
+}
+
+// ===================================================================================
+// Write SWD register block (request_count > 0 writes of request_value, streaming while
+// all ACKs are OK, the last write is not checked)
+//   req:    pointer to write data
+//   return: pointer behind the written data (result in response_value)
+// ===================================================================================
+static const __xdata uint8_t *DAP_SWD_WriteBlock(const __xdata uint8_t *req) {
+  do {
+    response_value = SWD_Transfer(request_value, (__xdata uint8_t *)req);
+    if(response_value != DAP_TRANSFER_OK) {
+      if(orun_detect) break;                      // overrun is checked by caller
+      DAP_SWD_TransferRetry(request_value, (__xdata uint8_t *)req);
+      if(response_value != DAP_TRANSFER_OK) break;
+    }
+    req += 4;
+    response_count++;
+  } while(--request_count);
+  return req;
 }
 
 // ===================================================================================
 // Process SWD Transfer Block command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_SWD_TransferBlock(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_SWD_TransferBlock(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  const __xdata uint8_t *request_head;
   __xdata uint8_t *response_head;
+  request_head = req;
   response_count = 0U;
   response_value = 0U;
   response_head = res;
   res += 3;
-  DAP_TransferAbort = 0U;
+  DAP_TransferStart();
   req++;                                          // ignore DAP index
   request_count = (uint16_t)(*(req + 0) << 0)
                 | (uint16_t)(*(req + 1) << 8);
@@ -1231,79 +1748,44 @@ static uint8_t DAP_SWD_TransferBlock(const __xdata uint8_t *req, __xdata uint8_t
   if(request_count == 0U) goto end;
 
   request_value = *req++;
+  if((request_value & SHADOW_ADDR) == SHADOW_DRW) swd_shadow_valid &= ~SHADOW_TAR;
+  else if(!(request_value & DAP_TRANSFER_RnW)) swd_shadow_valid = 0U;
   if((request_value & DAP_TRANSFER_RnW) != 0U) {
     // Read register block
-    if((request_value & DAP_TRANSFER_APnDP) != 0U) {
-      // Post AP read
-      retry = retry_count;
-      do {
-        response_value = SWD_Transfer(request_value, NULL);
-      } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-      if(response_value != DAP_TRANSFER_OK) goto end;
-    }
-    while(request_count--) {
-      // Read DP/AP register
-      if((request_count == 0U) && ((request_value & DAP_TRANSFER_APnDP) != 0U))
-        request_value = DP_RDBUFF | DAP_TRANSFER_RnW;   // Last AP read
-      retry = retry_count;
-      do {
-        response_value = SWD_Transfer(request_value, data);
-      } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-      if(response_value != DAP_TRANSFER_OK) goto end;
-
-      // Store data
-      *res++ = (uint8_t)data[0];
-      *res++ = (uint8_t)data[1];
-      *res++ = (uint8_t)data[2];
-      *res++ = (uint8_t)data[3];
-      response_count++;
-    }
+    res = DAP_SWD_ReadBlock(res);
   }
   else {
-    // Write register block
-    while(request_count--) {
-      // Load data
-      data[0] = (uint8_t)(*(req + 0));
-      data[1] = (uint8_t)(*(req + 1));
-      data[2] = (uint8_t)(*(req + 2));
-      data[3] = (uint8_t)(*(req + 3));
-      req += 4;
-
-      // Write DP/AP register
-      retry = retry_count;
-      do {
-        response_value = SWD_Transfer(request_value, data);
-      } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
-      if(response_value != DAP_TRANSFER_OK) goto end;
-      response_count++;
-    }
-    // Check last write
-    retry = retry_count;
-    do {
-      response_value = SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, NULL);
-    } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
+    // Write register block and check last write (or overrun)
+    DAP_SWD_WriteBlock(req);
+    DAP_SWD_CheckWrite();
   }
 
 end:
+  if(response_value != DAP_TRANSFER_OK) swd_shadow_valid = 0U;
+  DAP_SWD_ClearSticky();
   *(response_head + 0) = response_count;
   *(response_head + 1) = 0; 
   *(response_head + 2) = response_value;
-  return((uint8_t)(res - response_head));
+  return(DAP_TransferBlockSize(request_head, (uint8_t)(res - response_head)));
 }
 
 // ===================================================================================
 // Process JTAG Transfer Block command and prepare response
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_JTAG_TransferBlock(const __xdata uint8_t *req, __xdata uint8_t *res) {
+static uint16_t DAP_JTAG_TransferBlock(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  const __xdata uint8_t *request_head;
   __xdata uint8_t *response_head;
+  request_head = req;
   response_count = 0U;
   response_value = 0U;
   response_head  = res;
   res += 3;
-  DAP_TransferAbort = 0U;
+  DAP_TransferStart();
 
   // Device index (JTAP TAP)
   jtag_index = *req++;
@@ -1337,34 +1819,25 @@ static uint8_t DAP_JTAG_TransferBlock(const __xdata uint8_t *req, __xdata uint8_
       }
       retry = retry_count;
       do {
-        response_value = JTAG_Transfer(request_value, data);
+        response_value = JTAG_Transfer(request_value, res);
       } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
       if(response_value != DAP_TRANSFER_OK) goto end;
 
       // Store data
-      *res++ = (uint8_t)data[0];
-      *res++ = (uint8_t)data[1];
-      *res++ = (uint8_t)data[2];
-      *res++ = (uint8_t)data[3];
+      res += 4;
       response_count++;
     }
   }
   else {
     // Write register block
     while(request_count--) {
-      // Load data
-      data[0] = (uint8_t)(*(req + 0));
-      data[1] = (uint8_t)(*(req + 1));
-      data[2] = (uint8_t)(*(req + 2));
-      data[3] = (uint8_t)(*(req + 3));
-      req += 4;
-
       // Write DP/AP register
       retry = retry_count;
       do {
-        response_value = JTAG_Transfer(request_value, data);
+        response_value = JTAG_Transfer(request_value, (__xdata uint8_t *)req);
       } while((response_value == DAP_TRANSFER_WAIT) && retry-- && !DAP_TransferAbort);
       if(response_value != DAP_TRANSFER_OK) goto end;
+      req += 4;
       response_count++;
     }
 
@@ -1380,125 +1853,619 @@ end:
   *(response_head + 0) = response_count;
   *(response_head + 1) = 0; 
   *(response_head + 2) = response_value;
-  return((uint8_t)(res - response_head));
+  return(DAP_TransferBlockSize(request_head, (uint8_t)(res - response_head)));
 }
 
 // ===================================================================================
-// Process Transfer command and prepare response
+// Process Transfer command and prepare response (no port connected)
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response (lower 16 bits)
-//             number of bytes in request (upper 16 bits)
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_Transfer(const __xdata uint8_t *req, __xdata uint8_t *res) {
-  switch(debug_port) {
-    case DAP_PORT_SWD:
-      return DAP_SWD_Transfer(req, res);
-    case DAP_PORT_JTAG:
-      return DAP_JTAG_Transfer(req, res);
-    default:
-      *(res + 0) = 0U;
-      *(res + 1) = 0U;
-      break;
-  }
-  return 2;
+static uint16_t DAP_Transfer(const __xdata uint8_t *req) {
+  *(DAP_response + 0) = 0U;
+  *(DAP_response + 1) = 0U;
+  return(((uint16_t)(uint8_t)(DAP_SkipTransfer(req + 2, *(req + 1)) - req) << 8) | 2U);
 }
 
 // ===================================================================================
-// Process SWD Transfer Block command and prepare response
+// Process Transfer Block command and prepare response (no port connected)
 //   request:  pointer to request data
-//   response: pointer to response data
-//   return:   number of bytes in response
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-static uint8_t DAP_TransferBlock(const __xdata uint8_t *req, __xdata uint8_t *res) {
-  switch(debug_port) {
-    case DAP_PORT_SWD:
-      return DAP_SWD_TransferBlock(req, res);
-    case DAP_PORT_JTAG:
-      return DAP_JTAG_TransferBlock(req, res);
-    default:
-      *(res + 0) = 0U;    // res count [7:0]
-      *(res + 1) = 0U;    // res count[15:8]
-      *(res + 2) = 0U;    // res value
-      break;
-  }
-  return 3;
+static uint16_t DAP_TransferBlock(const __xdata uint8_t *req) {
+  *(DAP_response + 0) = 0U;                       // res count [7:0]
+  *(DAP_response + 1) = 0U;                       // res count[15:8]
+  *(DAP_response + 2) = 0U;                       // res value
+  return(DAP_TransferBlockSize(req, 3));
 }
 
 // ===================================================================================
-// DAP Thread.
+// Process Delay command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
 // ===================================================================================
-uint8_t DAP_Thread(void) {
-  uint8_t num;
-  uint8_t __xdata *req = DAP_READ_BUF_PTR;
-  uint8_t __xdata *res = DAP_WRITE_BUF_PTR;
-
-  *res++ = *req;
-  switch(*req++) {
-    case ID_DAP_Info:
-      num = DAP_Info(*req, res + 1);
-      *res = (uint8_t)num;
-      num++;
-      break;
-    case ID_DAP_HostStatus:
-      num = DAP_HostStatus(req, res);
-      break;
-    case ID_DAP_Connect:
-      num = DAP_Connect(req, res);
-      break;
-    case ID_DAP_Disconnect:
-      num = DAP_Disconnect(res);
-      break;
+static uint16_t DAP_Delay(const __xdata uint8_t *req) {
+  DLY_us((uint16_t)(*(req + 0) << 0)
+       | (uint16_t)(*(req + 1) << 8));
+  *DAP_response = DAP_OK;
+  return((2U << 8) | 1U);
+}
 
-    case ID_DAP_SWJ_Pins:
-      num = DAP_SWJ_Pins(req, res);
-      break;
-    case ID_DAP_SWJ_Clock:
-      *res = DAP_OK;
-      num = 1;
-      break;
-    case ID_DAP_SWJ_Sequence:
-      num = DAP_SWJ_Sequence(req, res);
-      break;
+// ===================================================================================
+// Process Reset Target command and prepare response
+// The reset sequence (nRESET pulse and wait time) is set in config.h.
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_ResetTarget(const __xdata uint8_t *req) {
+  req;                                            // stop unreferenced arg warning
+  *(DAP_response + 0) = DAP_OK;
+  swd_shadow_valid = 0U;
+  #if DAP_RESET_ENABLE > 0
+  RST_SET(0);                                     // assert nRESET
+  DLY_us(DAP_RESET_PULSE_us);
+  RST_SET(1);                                     // release nRESET
+  DLY_us(DAP_RESET_WAIT_us);
+  *(DAP_response + 1) = 1U;                       // reset sequence executed
+  #else
+  *(DAP_response + 1) = 0U;                       // reset sequence not implemented
+  #endif
+  return(2U);
+}
 
-    case ID_DAP_SWD_Configure:
-      *res = DAP_OK;
-      num = 1;
-      break;
-    case ID_DAP_SWD_Sequence:
-      num = DAP_SWD_Sequence(req, res);
-      break;
+// ===================================================================================
+// Process Write ABORT command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_WriteAbort(const __xdata uint8_t *req) {
+  req;                                            // stop unreferenced arg warning
+  *DAP_response = DAP_ERROR;                      // no port connected
+  return((5U << 8) | 1U);
+}
 
-    case ID_DAP_JTAG_Sequence:
-      num = DAP_JTAG_Sequence(req, res);
-      break;
-    case ID_DAP_JTAG_Configure:
-      num = DAP_JTAG_Configure(req, res);
-      break;
-    case ID_DAP_JTAG_IDCODE:
-      num = DAP_JTAG_IDCode(req, res);
-      break;
+// ===================================================================================
+// Process SWD Write ABORT command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_SWD_WriteAbort(const __xdata uint8_t *req) {
+  // Write Abort register (ignore DAP index)
+  SWD_Transfer(DP_ABORT, (__xdata uint8_t *)(req + 1));
+  *DAP_response = DAP_OK;
+  return((5U << 8) | 1U);
+}
 
-    case ID_DAP_TransferConfigure:
-      num = DAP_TransferConfigure(req, res);
+// ===================================================================================
+// Process JTAG Write ABORT command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_JTAG_WriteAbort(const __xdata uint8_t *req) {
+  // Device index (JTAP TAP)
+  jtag_index = *req;
+  if(jtag_index >= jtag_count) {
+    *DAP_response = DAP_ERROR;
+    return((5U << 8) | 1U);
+  }
+
+  // Select JTAG chain and write Abort register
+  JTAG_IR(JTAG_ABORT);
+  JTAG_WriteAbort((__xdata uint8_t *)(req + 1));
+  *DAP_response = DAP_OK;
+  return((5U << 8) | 1U);
+}
+
+// ===================================================================================
+// Process Set Option vendor command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_SetOption(const __xdata uint8_t *req) {
+  uint16_t value;
+
+  value = (uint16_t)(*(req + 1) << 0)
+        | (uint16_t)(*(req + 2) << 8);
+  *DAP_response = DAP_OK;
+  switch(*req) {
+    case DAP_OPTION_STICKY_CLEAR:
+      sticky_clear = value ? 1U : 0U;
       break;
-    case ID_DAP_Transfer:
-      num = DAP_SWD_Transfer(req, res);
+    case DAP_OPTION_MATCH_BACKOFF:
+      match_backoff = value;
       break;
-    case ID_DAP_TransferBlock:
-      num = DAP_TransferBlock(req, res);
+    case DAP_OPTION_WAIT_BACKOFF:
+      wait_backoff_init = (uint8_t)(value >> 0);
+      wait_backoff_max  = (uint8_t)(value >> 8);
+      if(wait_backoff_max < wait_backoff_init) wait_backoff_max = wait_backoff_init;
       break;
-
-    case ID_DAP_WriteABORT:
-      *res = DAP_OK;
-      num = 1;
+    case DAP_OPTION_ORUN_DETECT:
+      if(DAP_SWD_SetOverrun(value ? 1U : 0U) != DAP_TRANSFER_OK)
+        *DAP_response = DAP_ERROR;
       break;
-    case ID_DAP_ExecuteCommands:
-    case ID_DAP_QueueCommands:
     default:
-      *(res - 1) = ID_DAP_Invalid;
-      num = 1;
+      *DAP_response = DAP_ERROR;
       break;
   }
-  return(num + 1);
+  return((3U << 8) | 1U);
+}
+
+// ===================================================================================
+// Process Memory Block vendor command and prepare response
+// Reads/writes count words of a MEM-AP (DRW) starting at address. TAR is written by
+// the probe at the start and whenever the 1 KB auto-increment window wraps. CSW must
+// be set up by the host for 32-bit accesses with single increment and the MEM-AP
+// must be selected with APBANKSEL 0 (SWD only). Blocks that do not fit into one
+// packet are rejected with DAP_TRANSFER_ERROR.
+//   request:  mode (bit 0: RnW), address[31:0], count, write data
+//   response: DAP_response (count of transferred words, response value, read data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+#define MEMBLOCK_READ_MAX   ((DAP_PACKET_SIZE - 2U) / 4U)   // words per response
+#define MEMBLOCK_WRITE_MAX  ((DAP_PACKET_SIZE - 7U) / 4U)   // words per request
+static uint16_t DAP_MemoryBlock(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  const __xdata uint8_t *request_head;
+  __xdata uint8_t *response_head;
+  uint32_t address;
+  uint16_t room;
+  uint8_t mode;
+  uint8_t count;
+
+  request_head   = req;
+  response_head  = res;
+  res += 2;
+  response_count = 0U;
+  response_value = 0U;
+  DAP_TransferStart();
+
+  mode    = *req;
+  address = ((uint32_t)*(req + 1) <<  0)
+          | ((uint32_t)*(req + 2) <<  8)
+          | ((uint32_t)*(req + 3) << 16)
+          | ((uint32_t)*(req + 4) << 24);
+  count   = *(req + 5);
+  req += 6;
+  if(debug_port != DAP_PORT_SWD) goto end;
+  if(count > ((mode & DAP_TRANSFER_RnW) ? MEMBLOCK_READ_MAX : MEMBLOCK_WRITE_MAX)) {
+    response_value = DAP_TRANSFER_ERROR;
+    goto end;
+  }
+
+  while(count) {
+    // Write TAR (skipped if the shadow already holds the address)
+    data[0] = (uint8_t)(address >>  0);
+    data[1] = (uint8_t)(address >>  8);
+    data[2] = (uint8_t)(address >> 16);
+    data[3] = (uint8_t)(address >> 24);
+    if(!DAP_SWD_ShadowWrite(SHADOW_TAR_REQ, data)) {
+      response_value = SWD_Transfer(SHADOW_TAR_REQ, data);
+      DAP_SWD_TransferRetry(SHADOW_TAR_REQ, data);
+      if(response_value != DAP_TRANSFER_OK) break;
+    }
+    swd_shadow_valid &= ~SHADOW_TAR;
+
+    // Words up to the end of the auto-increment window
+    room = (AP_TAR_WINDOW - ((uint16_t)address & (AP_TAR_WINDOW - 1U))) >> 2;
+    request_count = (count < room) ? count : (uint8_t)room;
+    count   -= request_count;
+    address += (uint16_t)request_count << 2;
+
+    // Transfer block via DRW
+    if(mode & DAP_TRANSFER_RnW) {
+      request_value = SHADOW_DRW | DAP_TRANSFER_RnW;
+      res = DAP_SWD_ReadBlock(res);
+    }
+    else {
+      request_value = SHADOW_DRW;
+      req = DAP_SWD_WriteBlock(req);
+    }
+    if(response_value != DAP_TRANSFER_OK) break;
+  }
+
+  // Check last write
+  if(!(mode & DAP_TRANSFER_RnW)) DAP_SWD_CheckWrite();
+
+  // TAR continues at address unless the window wrapped (contiguous next command)
+  if((response_value == DAP_TRANSFER_OK) && ((uint16_t)address & (AP_TAR_WINDOW - 1U))) {
+    data[0] = (uint8_t)(address >>  0);
+    data[1] = (uint8_t)(address >>  8);
+    data[2] = (uint8_t)(address >> 16);
+    data[3] = (uint8_t)(address >> 24);
+    DAP_SWD_ShadowWrite(SHADOW_TAR_REQ, data);
+  }
+
+end:
+  if(response_value != DAP_TRANSFER_OK) swd_shadow_valid = 0U;
+  DAP_SWD_ClearSticky();
+  *(response_head + 0) = response_count;
+  *(response_head + 1) = response_value;
+  count = *(request_head + 5);                    // request size incl. write data
+  if((mode & DAP_TRANSFER_RnW) || (count > MEMBLOCK_WRITE_MAX)) count = 6U;
+  else count = 6U + (count << 2);
+  return(((uint16_t)count << 8) | (uint8_t)(res - response_head));
+}
+
+// ===================================================================================
+// Process Target Select vendor command and prepare response
+// Selects a target on a multi-drop SWD bus. The SELECT/CSW/TAR shadow and the power
+// state of the previous target are saved in its slot, those of the new target are
+// restored. If the power-up requested on that target is not acknowledged, the request
+// is written again to CTRL/STAT (SWD only).
+//   request:  target slot (0..DAP_TARGET_COUNT-1), TARGETSEL[31:0]
+//   response: DAP_response (response value, DPIDR[31:0])
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+__xdata uint8_t target_shadow[DAP_TARGET_COUNT][3][4];
+__xdata uint8_t target_shadow_valid[DAP_TARGET_COUNT];
+__xdata uint8_t target_power[DAP_TARGET_COUNT];
+static uint16_t DAP_TargetSelect(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  __xdata uint8_t *shadow;
+  uint8_t slot;
+  uint8_t n;
+
+  slot = *req;
+  response_value = DAP_TRANSFER_ERROR;
+  if((debug_port != DAP_PORT_SWD) || (slot >= DAP_TARGET_COUNT)) goto end;
+
+  // Save state of current target, restore state of selected target
+  shadow = &target_shadow[swd_target][0][0];
+  for(n = 0; n < 12; n++) shadow[n] = (&swd_shadow[0][0])[n];
+  target_shadow_valid[swd_target] = swd_shadow_valid;
+  target_power[swd_target] = swd_power;
+  swd_target_valid |= 1U << swd_target;
+
+  swd_target = slot;
+  swd_shadow_valid = 0U;
+  swd_power = 0U;
+  if(swd_target_valid & (1U << slot)) {
+    shadow = &target_shadow[slot][0][0];
+    for(n = 0; n < 12; n++) (&swd_shadow[0][0])[n] = shadow[n];
+    swd_shadow_valid = target_shadow_valid[slot];
+    swd_power = target_power[slot];
+  }
+
+  // Select target (TARGETSEL in response buffer, DPIDR returned in place)
+  for(n = 1; n < 5; n++) *(res + n) = *(req + n);
+  response_value = SWD_TargetSelect(res + 1);
+  if(response_value != DAP_TRANSFER_OK) goto end;
+
+  // Restore power state (CTRL/STAT accessible with DPBANKSEL 0)
+  if(swd_power && (swd_shadow_valid & SHADOW_SELECT) && !(swd_shadow[0][0] & 0x0FU)) {
+    response_value = SWD_Transfer(DP_CTRL_STAT | DAP_TRANSFER_RnW, data);
+    DAP_SWD_TransferRetry(DP_CTRL_STAT | DAP_TRANSFER_RnW, data);
+    if(response_value != DAP_TRANSFER_OK) goto end;
+    if((data[3] & DP_CTRL_PWRUPACK_B3) != (swd_power << 1)) {
+      data[3] |= swd_power;
+      response_value = SWD_Transfer(DP_CTRL_STAT, data);
+      DAP_SWD_TransferRetry(DP_CTRL_STAT, data);
+    }
+  }
+
+end:
+  if(response_value != DAP_TRANSFER_OK) {
+    swd_shadow_valid = 0U;
+    for(n = 1; n < 5; n++) *(res + n) = 0U;       // no valid DPIDR
+  }
+  *res = response_value;
+  return((5U << 8) | 5U);
+}
+
+// ===================================================================================
+// Process WAIT Count vendor command and prepare response
+//   request:  none
+//   response: DAP_response (WAIT responses of the last transfer batch [15:0])
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_WaitCount(const __xdata uint8_t *req) {
+  req;                                            // stop unreferenced arg warning
+  *(DAP_response + 0) = (uint8_t)(wait_count >> 0);
+  *(DAP_response + 1) = (uint8_t)(wait_count >> 8);
+  return(2U);
+}
+
+// ===================================================================================
+// Process Calibrate vendor command and prepare response
+// Sweeps the SWJ clock tiers from fastest to slowest. A tier passes if after a line
+// reset all rounds of DPIDR reads (compared with a reference read at the slowest tier)
+// and RDBUFF reads complete without ACK, parity or data errors. The fastest passing
+// tier is returned and adopted if requested (SWD only, includes line resets).
+//   request:  flags (bit 0: adopt clock), rounds per tier (0 = 256)
+//   response: DAP_response (DAP_OK/DAP_ERROR, tier, clock in Hz[31:0])
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_Calibrate(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  uint32_t clock;
+  uint8_t delay;
+  uint8_t tier;
+  uint16_t rounds;
+  uint8_t n;
+
+  delay = DAP_clockDelay;
+  tier  = sizeof(DAP_clockTierDelay);
+  if(debug_port != DAP_PORT_SWD) goto end;
+  swd_shadow_valid = 0U;
+
+  // Reference DPIDR at slowest tier (stored in response buffer)
+  DAP_clockDelay = DAP_clockTierDelay[sizeof(DAP_clockTierDelay) - 1];
+  SWD_LineReset();
+  if(SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, res + 2) != DAP_TRANSFER_OK) goto end;
+
+  // Stress pattern from fastest to slowest tier
+  for(tier = 0; tier < sizeof(DAP_clockTierDelay); tier++) {
+    DAP_clockDelay = DAP_clockTierDelay[tier];
+    SWD_LineReset();
+    rounds = *(req + 1);
+    if(rounds == 0U) rounds = 256U;
+    do {
+      if(SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, data) != DAP_TRANSFER_OK) break;
+      for(n = 0; n < 4; n++) {
+        if(data[n] != *(res + 2 + n)) break;
+      }
+      if(n != 4) break;
+      if(SWD_Transfer(DP_RDBUFF | DAP_TRANSFER_RnW, data) != DAP_TRANSFER_OK) break;
+    } while(--rounds);
+    if(rounds == 0U) break;                       // all rounds passed
+  }
+  if((tier < sizeof(DAP_clockTierDelay)) && (*req & 0x01U)) delay = DAP_clockDelay;
+
+  // Resynchronize at the final clock
+  DAP_clockDelay = delay;
+  SWD_LineReset();
+  SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, data);
+
+end:
+  DAP_clockDelay = delay;
+  if(tier < sizeof(DAP_clockTierDelay)) {
+    clock = DAP_clockTierHz[tier];
+    *(res + 0) = DAP_OK;
+    *(res + 1) = tier;
+  }
+  else {
+    clock = 0U;
+    *(res + 0) = DAP_ERROR;
+    *(res + 1) = 0xFFU;
+  }
+  *(res + 2) = (uint8_t)(clock >>  0);
+  *(res + 3) = (uint8_t)(clock >>  8);
+  *(res + 4) = (uint8_t)(clock >> 16);
+  *(res + 5) = (uint8_t)(clock >> 24);
+  return((2U << 8) | 6U);
+}
+
+// ===================================================================================
+// Process Fast Connect vendor command and prepare response
+// Runs the complete SWD connect and power-up sequence on the probe: connect SWD port,
+// line reset, JTAG-to-SWD switch, line reset, DPIDR read, sticky error clear via ABORT,
+// SELECT 0, power-up request in CTRL/STAT and polling for the power-up acknowledge.
+//   request:  poll count[15:0] (0 = match retry count of Transfer Configure)
+//   response: DAP_response (response value, DPIDR[31:0], CTRL/STAT[31:0])
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_FastConnect(const __xdata uint8_t *req) {
+  __xdata uint8_t *res = DAP_response;
+  uint16_t polls;
+  uint16_t saved;
+  uint8_t mask[4];
+  uint8_t n;
+
+  polls = (uint16_t)(*(req + 0) << 0)
+        | (uint16_t)(*(req + 1) << 8);
+  for(n = 1; n < 9; n++) *(res + n) = 0U;
+
+  // Connect SWD port
+  debug_port = DAP_PORT_SWD;
+  PORT_SWD_CONNECT();
+  DAP_commands = DAP_commandTable[DAP_PORT_SWD];
+  swd_shadow_valid = 0U;
+  swd_target_valid = 0U;
+  swd_target = 0U;
+  jtag_ir_valid = 0U;
+  DAP_TransferStart();
+
+  // Line reset ones, JTAG-to-SWD switch (0xE79E), line reset and DPIDR read
+  SWD_LineResetOnes();
+  SWD_WriteByte(0x9EU);
+  SWD_WriteByte(0xE7U);
+  SWD_LineReset();
+  response_value = SWD_Transfer(DP_IDCODE | DAP_TRANSFER_RnW, res + 1);
+  if(response_value != DAP_TRANSFER_OK) goto end;
+
+  // Clear sticky errors
+  data[0] = DP_ABORT_STKCMPCLR | DP_ABORT_STKERRCLR
+          | DP_ABORT_WDERRCLR  | DP_ABORT_ORUNERRCLR;
+  data[1] = 0U;
+  data[2] = 0U;
+  data[3] = 0U;
+  response_value = SWD_Transfer(DP_ABORT, data);
+  DAP_SWD_TransferRetry(DP_ABORT, data);
+  if(response_value != DAP_TRANSFER_OK) goto end;
+
+  // Select AP 0, bank 0 (recorded in shadow cache)
+  data[0] = 0U;
+  DAP_SWD_ShadowWrite(DP_SELECT, data);
+  response_value = SWD_Transfer(DP_SELECT, data);
+  DAP_SWD_TransferRetry(DP_SELECT, data);
+  if(response_value != DAP_TRANSFER_OK) goto end;
+
+  // Request debug and system power-up
+  data[3] = DP_CTRL_PWRUPREQ_B3;
+  DAP_SWD_ShadowWrite(DP_CTRL_STAT, data);
+  response_value = SWD_Transfer(DP_CTRL_STAT, data);
+  DAP_SWD_TransferRetry(DP_CTRL_STAT, data);
+  if(response_value != DAP_TRANSFER_OK) goto end;
+
+  // Poll power-up acknowledge (host match mask and retry count are preserved)
+  saved = match_retry_count;
+  if(polls) match_retry_count = polls;
+  for(n = 0; n < 4; n++) {
+    mask[n] = match_mask[n];
+    match_mask[n]  = 0U;
+    match_value[n] = 0U;
+  }
+  match_mask[3]  = DP_CTRL_PWRUPACK_B3;
+  match_value[3] = DP_CTRL_PWRUPACK_B3;
+  response_value = DAP_SWD_TransferMatch(DP_CTRL_STAT | DAP_TRANSFER_RnW);
+  match_retry_count = saved;
+  for(n = 0; n < 4; n++) {
+    match_mask[n] = mask[n];
+    *(res + 5 + n) = data[n];
+  }
+
+end:
+  if(response_value != DAP_TRANSFER_OK) swd_shadow_valid = 0U;
+  *res = response_value;
+  return((2U << 8) | 9U);
+}
+
+// ===================================================================================
+// Process unsupported command and prepare response
+//   request:  pointer to request data
+//   response: DAP_response (pointer to response data)
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_Invalid(const __xdata uint8_t *req) {
+  req;                                            // stop unreferenced arg warning
+  *(DAP_response - 1) = ID_DAP_Invalid;
+  return(0U);
+}
+
+// ===================================================================================
+// Command dispatch tables (indexed by debug port and command ID)
+// ===================================================================================
+#define DAP_COMMAND_TABLE(transfer, transferblock, writeabort) {            \
+  DAP_GetInfo,            /* 0x00 ID_DAP_Info              */               \
+  DAP_HostStatus,         /* 0x01 ID_DAP_HostStatus        */               \
+  DAP_Connect,            /* 0x02 ID_DAP_Connect           */               \
+  DAP_Disconnect,         /* 0x03 ID_DAP_Disconnect        */               \
+  DAP_TransferConfigure,  /* 0x04 ID_DAP_TransferConfigure */               \
+  transfer,               /* 0x05 ID_DAP_Transfer          */               \
+  transferblock,          /* 0x06 ID_DAP_TransferBlock     */               \
+  DAP_Invalid,            /* 0x07 ID_DAP_TransferAbort     */               \
+  writeabort,             /* 0x08 ID_DAP_WriteABORT        */               \
+  DAP_Delay,              /* 0x09 ID_DAP_Delay             */               \
+  DAP_ResetTarget,        /* 0x0A ID_DAP_ResetTarget       */               \
+  DAP_Invalid,            /* 0x0B                          */               \
+  DAP_Invalid,            /* 0x0C                          */               \
+  DAP_Invalid,            /* 0x0D                          */               \
+  DAP_Invalid,            /* 0x0E                          */               \
+  DAP_Invalid,            /* 0x0F                          */               \
+  DAP_SWJ_Pins,           /* 0x10 ID_DAP_SWJ_Pins          */               \
+  DAP_SWJ_Clock,          /* 0x11 ID_DAP_SWJ_Clock         */               \
+  DAP_SWJ_Sequence,       /* 0x12 ID_DAP_SWJ_Sequence      */               \
+  DAP_SWD_Configure,      /* 0x13 ID_DAP_SWD_Configure     */               \
+  DAP_JTAG_Sequence,      /* 0x14 ID_DAP_JTAG_Sequence     */               \
+  DAP_JTAG_Configure,     /* 0x15 ID_DAP_JTAG_Configure    */               \
+  DAP_JTAG_IDCode,        /* 0x16 ID_DAP_JTAG_IDCODE       */               \
+  DAP_Invalid,            /* 0x17 ID_DAP_SWO_Transport     */               \
+  DAP_Invalid,            /* 0x18 ID_DAP_SWO_Mode          */               \
+  DAP_Invalid,            /* 0x19 ID_DAP_SWO_Baudrate      */               \
+  DAP_Invalid,            /* 0x1A ID_DAP_SWO_Control       */               \
+  DAP_Invalid,            /* 0x1B ID_DAP_SWO_Status        */               \
+  DAP_Invalid,            /* 0x1C ID_DAP_SWO_Data          */               \
+  DAP_SWD_Sequence        /* 0x1D ID_DAP_SWD_Sequence      */               \
+}
+
+__code DAP_Handler DAP_commandTable[3][DAP_COMMAND_COUNT] = {
+  DAP_COMMAND_TABLE(DAP_Transfer,      DAP_TransferBlock,      DAP_WriteAbort),      // DISABLED
+  DAP_COMMAND_TABLE(DAP_SWD_Transfer,  DAP_SWD_TransferBlock,  DAP_SWD_WriteAbort),  // SWD
+  DAP_COMMAND_TABLE(DAP_JTAG_Transfer, DAP_JTAG_TransferBlock, DAP_JTAG_WriteAbort)  // JTAG
+};
+
+__code DAP_Handler DAP_vendorTable[DAP_VENDOR_COUNT] = {
+  DAP_SetOption,          // 0x80 ID_DAP_SetOption
+  DAP_MemoryBlock,        // 0x81 ID_DAP_MemoryBlock
+  DAP_TargetSelect,       // 0x82 ID_DAP_TargetSelect
+  DAP_WaitCount,          // 0x83 ID_DAP_WaitCount
+  DAP_Calibrate,          // 0x84 ID_DAP_Calibrate
+  DAP_FastConnect         // 0x85 ID_DAP_FastConnect
+};
+
+// ===================================================================================
+// Process single DAP command and prepare response
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_ProcessCommand(const __xdata uint8_t *req, __xdata uint8_t *res) {
+  DAP_Handler handler;
+  uint8_t id;
+
+  id = *req++;
+  *res++ = id;
+  if(id < DAP_COMMAND_COUNT) handler = DAP_commands[id];
+  else if((uint8_t)(id - ID_DAP_Vendor0) < DAP_VENDOR_COUNT)
+    handler = DAP_vendorTable[(uint8_t)(id - ID_DAP_Vendor0)];
+  else {
+    *(res - 1) = ID_DAP_Invalid;
+    return((1U << 8) | 1U);
+  }
+  DAP_response = res;
+  return(handler(req) + ((1U << 8) | 1U));
+}
+
+// ===================================================================================
+// Execute DAP command (process request and prepare response)
+// Multiple commands packed into one request by DAP_ExecuteCommands (or queued by
+// DAP_QueueCommands) are processed one after the other within the same packet.
+// Queued packets are held back by the HID packet ring until a packet with another
+// command arrives and are answered like DAP_ExecuteCommands.
+//   request:  pointer to request data
+//   response: pointer to response data
+//   return:   number of bytes in response (lower 8 bits)
+//             number of bytes in request (upper 8 bits)
+// ===================================================================================
+static uint16_t DAP_ExecuteCommand(const __xdata uint8_t *req, __xdata uint8_t *res) {
+  uint16_t num;
+  uint16_t n;
+  uint8_t cnt;
+
+  if((*req == ID_DAP_ExecuteCommands) || (*req == ID_DAP_QueueCommands)) {
+    *res++ = ID_DAP_ExecuteCommands;
+    req++;
+    cnt = *req++;
+    *res++ = cnt;
+    num = (2U << 8) | 2U;
+    while(cnt-- && ((uint8_t)(num >> 8) < DAP_PACKET_SIZE)) {
+      n = DAP_ProcessCommand(req, res);
+      num += n;
+      req += (uint8_t)(n >> 8);
+      res += (uint8_t)n;
+    }
+    return num;
+  }
+  return DAP_ProcessCommand(req, res);
+}
+
+// ===================================================================================
+// DAP Thread.
+//   return:   number of bytes in response
+// ===================================================================================
+uint8_t DAP_Thread(void) {
+  return((uint8_t)DAP_ExecuteCommand(DAP_READ_BUF_PTR, DAP_WRITE_BUF_PTR));
 }
@@ -67,6 +67,8 @@
 #define ID_DAP_QueueCommands      0x7EU
 #define ID_DAP_ExecuteCommands    0x7FU
 
+#define DAP_COMMAND_COUNT         0x1EU // entries in command dispatch table
+
 // DAP Vendor Command IDs
 #define ID_DAP_Vendor0            0x80U
 #define ID_DAP_Vendor1            0x81U
@@ -101,6 +103,23 @@
 #define ID_DAP_Vendor30           0x9EU
 #define ID_DAP_Vendor31           0x9FU
 
+// DAP Vendor Commands
+#define ID_DAP_SetOption          ID_DAP_Vendor0
+#define ID_DAP_MemoryBlock        ID_DAP_Vendor1
+#define ID_DAP_TargetSelect       ID_DAP_Vendor2
+#define ID_DAP_WaitCount          ID_DAP_Vendor3
+#define ID_DAP_Calibrate          ID_DAP_Vendor4
+#define ID_DAP_FastConnect        ID_DAP_Vendor5
+
+#define DAP_VENDOR_COUNT          6U    // entries in vendor command dispatch table
+
+// DAP Vendor Options (ID_DAP_SetOption)
+#define DAP_OPTION_STICKY_CLEAR   0x01U // clear sticky errors after FAULT (0/1)
+#define DAP_OPTION_MATCH_BACKOFF  0x02U // back-off between value match polls in us
+#define DAP_OPTION_ORUN_DETECT    0x03U // SWD overrun detection write mode (0/1)
+#define DAP_OPTION_WAIT_BACKOFF   0x04U // idle cycles before WAIT retry: initial[7:0],
+                                        // doubled up to max[15:8] (0 = no back-off)
+
 #define ID_DAP_Invalid            0xFFU
 
 // DAP Status Code
@@ -120,6 +139,12 @@
 #define DAP_ID_PACKET_COUNT       0xFEU
 #define DAP_ID_PACKET_SIZE        0xFFU
 
+// DAP Capabilities
+#define DAP_CAP_SWD               (1U << 0)
+#define DAP_CAP_JTAG              (1U << 1)
+#define DAP_CAP_ATOMIC            (1U << 4)     // Atomic Commands (Execute/QueueCommands)
+#define DAP_CAP_TIMESTAMP         (1U << 5)     // Test Domain Timer
+
 // DAP Host Status
 #define DAP_DEBUGGER_CONNECTED    0U
 #define DAP_TARGET_RUNNING        1U
@@ -160,6 +185,7 @@
 #define DAP_TRANSFER_FAULT        (1U << 2)
 #define DAP_TRANSFER_ERROR        (1U << 3)
 #define DAP_TRANSFER_MISMATCH     (1U << 4)
+#define DAP_TRANSFER_CLEARED      (1U << 5)     // vendor: sticky errors cleared
 
 // DAP SWO Trace Mode
 #define DAP_SWO_OFF               0U
@@ -180,6 +206,28 @@
 #define DP_SELECT                 0x08U // Select Register (JTAG R/W & SW W)
 #define DP_RESEND                 0x08U // Resend (SW Read Only)
 #define DP_RDBUFF                 0x0CU // Read Buffer (Read Only)
+#define DP_TARGETSEL              0x0CU // Target Select (SW Write only, DPv2)
+
+// MEM-AP Register Addresses (APBANKSEL 0)
+#define AP_CSW                    0x00U // Control/Status Word
+#define AP_TAR                    0x04U // Transfer Address
+#define AP_DRW                    0x0CU // Data Read/Write
+
+// MEM-AP auto-increment window (TAR[9:0])
+#define AP_TAR_WINDOW             0x400U
+
+// Debug Port ABORT Register Bits
+#define DP_ABORT_STKCMPCLR        (1U << 1)
+#define DP_ABORT_STKERRCLR        (1U << 2)
+#define DP_ABORT_WDERRCLR         (1U << 3)
+#define DP_ABORT_ORUNERRCLR       (1U << 4)
+
+// Debug Port CTRL/STAT Register Bits
+#define DP_CTRL_ORUNDETECT        (1U << 0)
+#define DP_CTRL_STICKYORUN        (1U << 1)
+#define DP_CTRL_STICKYERR         (1U << 5)
+#define DP_CTRL_PWRUPREQ_B3       0x50U // CSYSPWRUPREQ, CDBGPWRUPREQ in CTRL/STAT[31:24]
+#define DP_CTRL_PWRUPACK_B3       0xA0U // CSYSPWRUPACK, CDBGPWRUPACK in CTRL/STAT[31:24]
 
 // JTAG IR Codes
 #define JTAG_ABORT                0x08U
@@ -197,8 +245,10 @@
 #define SWD_SEQUENCE_CLK          0x3FU // SWCLK count
 #define SWD_SEQUENCE_DIN          0x80U // SWDIO capture
 
-#define DAP_PACKET_COUNT          1
+#define DAP_PACKET_COUNT          2     // HID PACKET RING SLOTS
 #define DAP_PACKET_SIZE           64    // THIS ENDP SIZE
 #define DAP_DEFAULT_PORT          DAP_PORT_SWD
 
 extern uint8_t DAP_Thread(void);
+extern void DAP_TIMER_interrupt(void);
+extern volatile __idata uint8_t DAP_TransferAbort;
@@ -0,0 +1,857 @@
+// ===================================================================================
+// CMSIS-DAP I/O Kernels for CH552 DAPLink
+// ===================================================================================
+// Hand-written 8051 assembly versions of the time critical I/O functions. They are
+// used instead of the C versions if DAP_ASM_KERNEL is set in config.h.
+
+#include "dap.h"
+
+// ===================================================================================
+// SWD Request Header Table
+// Ready-to-shift packet request (LSB first) indexed by APnDP, RnW, A2, A3 (req bits
+// 0..3): start, APnDP, RnW, A2, A3, parity, stop, park.
+// ===================================================================================
+__code uint8_t SWD_header[16] = {
+  0x81, 0xA3, 0xA5, 0x87, 0xA9, 0x8B, 0x8D, 0xAF,
+  0xB1, 0x93, 0x95, 0xB7, 0x99, 0xBB, 0xBD, 0x9F
+};
+
+#if DAP_ASM_KERNEL > 0
+
+// ===================================================================================
+// SWD Shift Primitives
+//   val:    bits to shift out (LSB first)
+//   n:      number of bits (1..8)
+//   return: captured bits (LSB first, right aligned)
+// The delay of the selected clock tier (DAP_clockDelay) is inserted into the SWCLK
+// low phase, separate loops are used for maximum speed and for the short delay tier.
+// ===================================================================================
+void SWD_WriteBits(uint8_t val, uint8_t n) __naked {
+  val;                          // stop unreferenced argument warnings
+  n;
+  __asm
+    mov  a, dpl                 ; a <- val
+    mov  r6, _SWD_WriteBits_PARM_2 ; r6 <- n
+    mov  r5, _DAP_clockDelay    ; r5 <- clock tier delay
+    cjne r5, #0, 06$            ; delay selected?
+    01$:
+    rrc  a                      ; c <- next bit
+    mov  PIN_asm(PIN_SWD), c    ; set SWDIO
+    clr  PIN_asm(PIN_SWK)       ; clock cycle
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 01$                ; repeat n times
+    ret
+    06$:
+    cjne r5, #1, 08$            ; short delay selected?
+    07$:
+    rrc  a                      ; c <- next bit
+    mov  PIN_asm(PIN_SWD), c    ; set SWDIO
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with short delay
+    nop
+    nop
+    nop
+    nop
+    nop
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 07$                ; repeat n times
+    ret
+    08$:
+    dec  r5                     ; r5 <- delay call argument
+    02$:
+    rrc  a                      ; c <- next bit
+    mov  PIN_asm(PIN_SWD), c    ; set SWDIO
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with delay
+    mov  dpl, r5
+    lcall __delay_more_cycles
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 02$                ; repeat n times
+    ret
+  __endasm;
+}
+
+uint8_t SWD_ReadBits(uint8_t n) __naked {
+  n;                            // stop unreferenced argument warning
+  __asm
+    mov  r6, dpl                ; r6 <- n
+    mov  a, #8
+    clr  c
+    subb a, r6
+    mov  r4, a                  ; r4 <- 8 - n (alignment shifts)
+    mov  r5, _DAP_clockDelay    ; r5 <- clock tier delay
+    cjne r5, #0, 06$            ; delay selected?
+    01$:
+    clr  PIN_asm(PIN_SWK)       ; clock cycle
+    mov  c, PIN_asm(PIN_SWD)    ; c <- SWDIO
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; shift in from MSB
+    djnz r6, 01$                ; repeat n times
+    sjmp 03$
+    06$:
+    cjne r5, #1, 08$            ; short delay selected?
+    07$:
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with short delay
+    nop
+    nop
+    nop
+    nop
+    nop
+    mov  c, PIN_asm(PIN_SWD)    ; c <- SWDIO
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; shift in from MSB
+    djnz r6, 07$                ; repeat n times
+    sjmp 03$
+    08$:
+    dec  r5                     ; r5 <- delay call argument
+    02$:
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with delay
+    mov  dpl, r5
+    lcall __delay_more_cycles
+    mov  c, PIN_asm(PIN_SWD)    ; c <- SWDIO
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; shift in from MSB
+    djnz r6, 02$                ; repeat n times
+    03$:
+    mov  r6, a
+    mov  a, r4
+    jz   05$                    ; full byte?
+    mov  a, r6
+    04$:
+    clr  c
+    rrc  a                      ; right align captured bits
+    djnz r4, 04$
+    mov  r6, a
+    05$:
+    mov  dpl, r6                ; return captured bits
+    ret
+  __endasm;
+}
+
+// ===================================================================================
+// JTAG Shift Primitives
+//   val:    TDI bits to shift out (LSB first)
+//   n:      number of bits (1..8)
+//   return: captured TDO bits (LSB first, right aligned)
+// TMS is left unchanged. As with SWD, the bits are moved through the carry flag and
+// the delay of the selected clock tier is inserted into the TCK low phase.
+// ===================================================================================
+void JTAG_WriteBits(uint8_t val, uint8_t n) __naked {
+  val;                          // stop unreferenced argument warnings
+  n;
+  __asm
+    mov  a, dpl                 ; a <- val
+    mov  r6, _JTAG_WriteBits_PARM_2 ; r6 <- n
+    mov  r5, _DAP_clockDelay    ; r5 <- clock tier delay
+    cjne r5, #0, 06$            ; delay selected?
+    01$:
+    rrc  a                      ; c <- next bit
+    mov  PIN_asm(PIN_TDI), c    ; set TDI
+    clr  PIN_asm(PIN_SWK)       ; clock cycle
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 01$                ; repeat n times
+    ret
+    06$:
+    cjne r5, #1, 08$            ; short delay selected?
+    07$:
+    rrc  a                      ; c <- next bit
+    mov  PIN_asm(PIN_TDI), c    ; set TDI
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with short delay
+    nop
+    nop
+    nop
+    nop
+    nop
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 07$                ; repeat n times
+    ret
+    08$:
+    dec  r5                     ; r5 <- delay call argument
+    02$:
+    rrc  a                      ; c <- next bit
+    mov  PIN_asm(PIN_TDI), c    ; set TDI
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with delay
+    mov  dpl, r5
+    lcall __delay_more_cycles
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 02$                ; repeat n times
+    ret
+  __endasm;
+}
+
+uint8_t JTAG_ReadBits(uint8_t n) __naked {
+  n;                            // stop unreferenced argument warning
+  __asm
+    mov  r6, dpl                ; r6 <- n
+    mov  a, #8
+    clr  c
+    subb a, r6
+    mov  r4, a                  ; r4 <- 8 - n (alignment shifts)
+    mov  r5, _DAP_clockDelay    ; r5 <- clock tier delay
+    cjne r5, #0, 06$            ; delay selected?
+    01$:
+    clr  PIN_asm(PIN_SWK)       ; clock cycle
+    mov  c, PIN_asm(PIN_TDO)    ; c <- TDO
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; shift in from MSB
+    djnz r6, 01$                ; repeat n times
+    sjmp 03$
+    06$:
+    cjne r5, #1, 08$            ; short delay selected?
+    07$:
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with short delay
+    nop
+    nop
+    nop
+    nop
+    nop
+    mov  c, PIN_asm(PIN_TDO)    ; c <- TDO
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; shift in from MSB
+    djnz r6, 07$                ; repeat n times
+    sjmp 03$
+    08$:
+    dec  r5                     ; r5 <- delay call argument
+    02$:
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with delay
+    mov  dpl, r5
+    lcall __delay_more_cycles
+    mov  c, PIN_asm(PIN_TDO)    ; c <- TDO
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; shift in from MSB
+    djnz r6, 02$                ; repeat n times
+    03$:
+    mov  r6, a
+    mov  a, r4
+    jz   05$                    ; full byte?
+    mov  a, r6
+    04$:
+    clr  c
+    rrc  a                      ; right align captured bits
+    djnz r4, 04$
+    mov  r6, a
+    05$:
+    mov  dpl, r6                ; return captured bits
+    ret
+  __endasm;
+}
+
+uint8_t JTAG_ShiftBits(uint8_t val, uint8_t n) __naked {
+  val;                          // stop unreferenced argument warnings
+  n;
+  __asm
+    mov  r6, _JTAG_ShiftBits_PARM_2 ; r6 <- n
+    mov  a, #8
+    clr  c
+    subb a, r6
+    mov  r4, a                  ; r4 <- 8 - n (alignment shifts)
+    mov  a, dpl                 ; a <- val
+    mov  r5, _DAP_clockDelay    ; r5 <- clock tier delay
+    cjne r5, #0, 06$            ; delay selected?
+    01$:
+    rrc  a                      ; c <- next TDI bit, last TDO bit -> MSB
+    mov  PIN_asm(PIN_TDI), c    ; set TDI
+    clr  PIN_asm(PIN_SWK)       ; clock cycle
+    mov  c, PIN_asm(PIN_TDO)    ; c <- TDO
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 01$                ; repeat n times
+    sjmp 03$
+    06$:
+    cjne r5, #1, 08$            ; short delay selected?
+    07$:
+    rrc  a                      ; c <- next TDI bit, last TDO bit -> MSB
+    mov  PIN_asm(PIN_TDI), c    ; set TDI
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with short delay
+    nop
+    nop
+    nop
+    nop
+    nop
+    mov  c, PIN_asm(PIN_TDO)    ; c <- TDO
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 07$                ; repeat n times
+    sjmp 03$
+    08$:
+    dec  r5                     ; r5 <- delay call argument
+    02$:
+    rrc  a                      ; c <- next TDI bit, last TDO bit -> MSB
+    mov  PIN_asm(PIN_TDI), c    ; set TDI
+    clr  PIN_asm(PIN_SWK)       ; clock cycle with delay
+    mov  dpl, r5
+    lcall __delay_more_cycles
+    mov  c, PIN_asm(PIN_TDO)    ; c <- TDO
+    setb PIN_asm(PIN_SWK)
+    djnz r6, 02$                ; repeat n times
+    03$:
+    rrc  a                      ; final TDO bit -> MSB
+    mov  r6, a
+    mov  a, r4
+    jz   05$                    ; full byte?
+    mov  a, r6
+    04$:
+    clr  c
+    rrc  a                      ; right align captured bits
+    djnz r4, 04$
+    mov  r6, a
+    05$:
+    mov  dpl, r6                ; return captured bits
+    ret
+  __endasm;
+}
+
+// ===================================================================================
+// SWD Transfer I/O (maximum speed, default SWD configuration)
+//   request: A[3:2] RnW APnDP
+//   data:    DATA[31:0]
+//   return:  ACK[2:0]
+// Bits are shifted via carry flag (RRC A / MOV bit,C and MOV C,bit / RRC A), the data
+// phase is fully unrolled. Parity is taken from the accumulator parity flag.
+// ===================================================================================
+uint8_t SWD_TransferFast(uint8_t req, __xdata uint8_t *data) __naked {
+  req;                          // stop unreferenced argument warnings
+  data;
+  __asm
+    mov  r7, dpl                ; r7 <- req
+    mov  r6, #0x01              ; r6 <- ack (DAP_TRANSFER_OK)
+
+    ; Packet request: start, APnDP, RnW, A2, A3, parity, stop, park
+    mov  a, r7
+    anl  a, #0x0F               ; APnDP, RnW, A2, A3
+    mov  dptr, #_SWD_header
+    movc a, @a+dptr             ; a <- request header
+    rrc  a                      ; start bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; APnDP bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; RnW bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; A2 bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; A3 bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; parity bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; stop bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a                      ; park bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+
+    ; Turnaround
+    setb PIN_asm(PIN_SWD)       ; release SWDIO
+    clr  PIN_asm(PIN_SWK)       ; turnaround clock
+    setb PIN_asm(PIN_SWK)
+
+    ; Acknowledge response
+    clr  PIN_asm(PIN_SWK)       ; ACK.0
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)       ; ACK.1
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)       ; ACK.2
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    swap a                      ; ACK[2:0] from acc[7:5] ...
+    rr   a                      ; ... to acc[2:0]
+    anl  a, #0x07
+    cjne a, #0x01, 20$          ; DAP_TRANSFER_OK?
+    sjmp 01$
+
+    ; WAIT or FAULT response
+    20$:
+    mov  r6, a                  ; r6 <- ack
+    cjne a, #0x02, 21$          ; DAP_TRANSFER_WAIT?
+    sjmp 22$
+    21$:
+    cjne a, #0x04, 23$          ; DAP_TRANSFER_FAULT?
+    22$:
+    mov  r0, #_swd_data_phase
+    mov  a, @r0
+    jz   26$                    ; data phase required?
+    mov  r4, #(32 + 1)
+    mov  a, r7
+    jnb  acc.1, 27$             ; RnW = 0: dummy write after turnaround
+    25$:
+    clr  PIN_asm(PIN_SWK)       ; dummy read RDATA[0:31] + parity
+    setb PIN_asm(PIN_SWK)
+    djnz r4, 25$
+    26$:
+    clr  PIN_asm(PIN_SWK)       ; turnaround
+    setb PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWD)
+    mov  dpl, r6                ; return ack
+    ret
+    27$:
+    clr  PIN_asm(PIN_SWK)       ; turnaround
+    setb PIN_asm(PIN_SWK)
+    clr  PIN_asm(PIN_SWD)
+    28$:
+    clr  PIN_asm(PIN_SWK)       ; dummy write WDATA[0:31] + parity
+    setb PIN_asm(PIN_SWK)
+    djnz r4, 28$
+    setb PIN_asm(PIN_SWD)
+    mov  dpl, r6                ; return ack
+    ret
+
+    ; Protocol error: clock out 32 bits + parity + turnaround
+    23$:
+    mov  r4, #(32 + 1 + 1)
+    24$:
+    clr  PIN_asm(PIN_SWK)       ; back off data phase
+    setb PIN_asm(PIN_SWK)
+    djnz r4, 24$
+    setb PIN_asm(PIN_SWD)
+    mov  dpl, r6                ; return ack
+    ret
+
+    ; OK response
+    01$:
+    mov  dpl, _SWD_TransferFast_PARM_2 ; dptr <- data
+    mov  dph, (_SWD_TransferFast_PARM_2 + 1)
+    mov  a, r7
+    jnb  acc.7, 02$             ; timestamp requested?
+    push dpl
+    push dph
+    push ar6
+    push ar7
+    lcall _DAP_Timestamp        ; capture timestamp
+    pop  ar7
+    pop  ar6
+    pop  dph
+    pop  dpl
+    02$:
+    mov  a, r7
+    jb   acc.1, 03$             ; RnW = 1: read data
+    ljmp 10$                    ; RnW = 0: write data
+
+    ; Read RDATA[0:31]
+    03$:
+    clr  PIN_asm(PIN_SWK)       ; RDATA0
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  r2, a                  ; r2 <- data byte 0
+    clr  PIN_asm(PIN_SWK)       ; RDATA8
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  r3, a                  ; r3 <- data byte 1
+    clr  PIN_asm(PIN_SWK)       ; RDATA16
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  r4, a                  ; r4 <- data byte 2
+    clr  PIN_asm(PIN_SWK)       ; RDATA24
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    clr  PIN_asm(PIN_SWK)
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  r5, a                  ; r5 <- data byte 3
+    xrl  a, r2                  ; p <- parity of RDATA
+    xrl  a, r3
+    xrl  a, r4
+    clr  PIN_asm(PIN_SWK)       ; read parity bit
+    mov  c, PIN_asm(PIN_SWD)
+    setb PIN_asm(PIN_SWK)
+    jnb  _P, 04$
+    cpl  c                      ; c <- parity bit ^ data parity
+    04$:
+    jnc  05$                    ; parity ok?
+    mov  r6, #0x08              ; r6 <- ack (DAP_TRANSFER_ERROR)
+    05$:
+    clr  PIN_asm(PIN_SWK)       ; turnaround
+    setb PIN_asm(PIN_SWK)
+    mov  a, dpl
+    orl  a, dph
+    jz   06$                    ; data == NULL?
+    mov  a, r2
+    movx @dptr, a               ; store data byte
+    inc  dptr
+    mov  a, r3
+    movx @dptr, a               ; store data byte
+    inc  dptr
+    mov  a, r4
+    movx @dptr, a               ; store data byte
+    inc  dptr
+    mov  a, r5
+    movx @dptr, a               ; store data byte
+    inc  dptr
+    06$:
+    ljmp 30$
+
+    ; Write WDATA[0:31]
+    10$:
+    clr  PIN_asm(PIN_SWK)       ; turnaround
+    setb PIN_asm(PIN_SWK)
+    movx a, @dptr               ; load data byte
+    inc  dptr
+    mov  r2, a
+    movx a, @dptr               ; load data byte
+    inc  dptr
+    mov  r3, a
+    movx a, @dptr               ; load data byte
+    inc  dptr
+    mov  r4, a
+    movx a, @dptr               ; load data byte
+    inc  dptr
+    mov  r5, a
+    xrl  a, r2                  ; p <- parity of WDATA
+    xrl  a, r3
+    xrl  a, r4
+    mov  c, _P
+    clr  a
+    rlc  a
+    mov  r1, a                  ; r1 <- parity bit
+    mov  a, r2
+    rrc  a                      ; WDATA0
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    mov  a, r3
+    rrc  a                      ; WDATA8
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    mov  a, r4
+    rrc  a                      ; WDATA16
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    mov  a, r5
+    rrc  a                      ; WDATA24
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    rrc  a
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    mov  a, r1
+    rrc  a                      ; parity bit
+    mov  PIN_asm(PIN_SWD), c
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+
+    ; Idle cycles
+    30$:
+    mov  r0, #_idle_cycles
+    mov  a, @r0
+    jz   32$
+    mov  r4, a
+    clr  PIN_asm(PIN_SWD)
+    31$:
+    clr  PIN_asm(PIN_SWK)
+    setb PIN_asm(PIN_SWK)
+    djnz r4, 31$
+    32$:
+    setb PIN_asm(PIN_SWD)
+    mov  dpl, r6                ; return ack
+    ret
+  __endasm;
+}
+
+#else
+
+// ===================================================================================
+// SWD Shift Primitives (C versions)
+//   val:    bits to shift out (LSB first)
+//   n:      number of bits (1..8)
+//   return: captured bits (LSB first, right aligned)
+// ===================================================================================
+void SWD_WriteBits(uint8_t val, uint8_t n) {
+  do {
+    SWD_WRITE_BIT(val);
+    val >>= 1;
+  } while(--n);
+}
+
+uint8_t SWD_ReadBits(uint8_t n) {
+  uint8_t val = 0U;
+  uint8_t bit;
+  uint8_t k = 8U - n;
+
+  do {
+    SWD_READ_BIT(bit);
+    val >>= 1;
+    if(bit) val |= 0x80;
+  } while(--n);
+  return(val >> k);
+}
+
+// ===================================================================================
+// JTAG Shift Primitives (C versions)
+//   val:    TDI bits to shift out (LSB first)
+//   n:      number of bits (1..8)
+//   return: captured TDO bits (LSB first, right aligned)
+// ===================================================================================
+void JTAG_WriteBits(uint8_t val, uint8_t n) {
+  do {
+    JTAG_CYCLE_TDI(val & 1);
+    val >>= 1;
+  } while(--n);
+}
+
+uint8_t JTAG_ReadBits(uint8_t n) {
+  uint8_t val = 0U;
+  uint8_t bit;
+  uint8_t k = 8U - n;
+
+  do {
+    JTAG_CYCLE_TDO(bit);
+    val >>= 1;
+    if(bit) val |= 0x80;
+  } while(--n);
+  return(val >> k);
+}
+
+uint8_t JTAG_ShiftBits(uint8_t val, uint8_t n) {
+  uint8_t o_val = 0U;
+  uint8_t bit;
+  uint8_t k = 8U - n;
+
+  do {
+    JTAG_CYCLE_TDIO(val & 1, bit);
+    val >>= 1;
+    o_val >>= 1;
+    if(bit) o_val |= 0x80;
+  } while(--n);
+  return(o_val >> k);
+}
+
+#endif // DAP_ASM_KERNEL
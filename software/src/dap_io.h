@@ -6,6 +6,7 @@
 #include "ch554.h"
 #include "gpio.h"
 #include "config.h"
+#include "delay.h"
 
 
 // ===================================================================================
@@ -20,7 +21,31 @@
 #define SWD_GET()             PIN_read(PIN_SWD)
 #define RST_GET()             PIN_read(PIN_RST)
 
-#define PIN_DELAY()
+// SWJ clock tiers (selected by DAP_SWJ_Clock via DAP_clockDelay d)
+// d = 0: maximum speed without delay, d = 1: short delay of DAP_CLOCK_SHORT cycles,
+// d > 1: delay call of 20 + 4 * (d - 2) cycles, all in the SWCLK/TCK low phase.
+// CPU cycles per SWCLK/TCK period without the delay, counted from the shift loops of
+// the I/O kernels (RRC 1, MOV bit,C / MOV C,bit / CLR / SETB 2, DJNZ taken 4 cycles).
+#if DAP_ASM_KERNEL > 0
+#define DAP_CLOCK_CYCLES      7     // unrolled data phase of SWD_TransferFast
+#define DAP_CLOCK_CYCLES_SLOW 11    // shift loops of the SWD/JTAG primitives
+#else
+#define DAP_CLOCK_CYCLES      25    // C shift loops (SDCC code, estimated)
+#define DAP_CLOCK_CYCLES_SLOW 30    // C shift loops incl. the tier checks
+#endif
+#define DAP_CLOCK_SHORT       5     // NOPs of the short delay tier
+#define DAP_CLOCK_HZ(d)       ((d) == 0 ? (F_CPU / DAP_CLOCK_CYCLES) :                        \
+                               (d) == 1 ? (F_CPU / (DAP_CLOCK_CYCLES_SLOW + DAP_CLOCK_SHORT)) : \
+                                          (F_CPU / (DAP_CLOCK_CYCLES_SLOW + 20 + 4 * ((d) - 2))))
+extern __data uint8_t DAP_clockDelay;
+
+// SWCLK/TCK half-period delay
+#define PIN_DELAY_FAST()
+#define PIN_DELAY_SHORT()     _delay_cycles_5()
+#define PIN_DELAY_SLOW()      if(DAP_clockDelay == 1U) PIN_DELAY_SHORT(); \
+                              else _delay_more_cycles(DAP_clockDelay - 1U)
+#define PIN_DELAY_TIER()      if(DAP_clockDelay) { PIN_DELAY_SLOW(); }
+#define PIN_DELAY()           PIN_DELAY_TIER()
 
 // Connect SWD port (setup port for data transmission)
 #define PORT_SWD_CONNECT() {  \
@@ -125,6 +150,15 @@
   LED_PRT_SET(0);             \
 }
 
+// Timestamp timer (Timer0 16-bit at Fsys, extended to 32 bits by overflow interrupt)
+#define TIMESTAMP_CLOCK       F_CPU // timestamp clock in Hz
+#define TIMESTAMP_SETUP() {   \
+  T2MOD |= bTMR_CLK | bT0_CLK;\
+  TMOD = TMOD & 0xF0 | bT0_M0;\
+  TR0 = 1;                    \
+  ET0 = 1;                    \
+}
+
 // LED I/O pin manipulations
 #define LED_PRT_SET(val)      PIN_write(PIN_LED, !(val))  // LED is active low
 #define LED_CON_SET(val)
@@ -135,11 +169,37 @@
 // GENERAL CONFIG
 // ===================================================================================
 
-// HID transfer buffers
-#define DAP_READ_BUF_PTR      EP1_buffer
-#define DAP_WRITE_BUF_PTR     EP1_buffer + 64
-extern __xdata uint8_t EP1_buffer[];
+// Assembly I/O kernels (dap_io.c) and the DAP variables they use
+#if DAP_ASM_KERNEL > 0
+extern uint8_t SWD_TransferFast(uint8_t req, __xdata uint8_t *data);
+#endif
+extern __idata uint8_t idle_cycles;
+extern __idata uint8_t swd_data_phase;
+extern void DAP_Timestamp(void);
+
+// SWD request header table (indexed by req bits 0..3, dap_io.c)
+extern __code uint8_t SWD_header[16];
+
+// SWD shift primitives (n = 1..8 bits, LSB first, dap_io.c)
+extern void SWD_WriteBits(uint8_t val, uint8_t n);
+extern uint8_t SWD_ReadBits(uint8_t n);
+#define SWD_WriteByte(val)    SWD_WriteBits(val, 8)
+#define SWD_ReadByte()        SWD_ReadBits(8)
+
+// JTAG shift primitives (n = 1..8 bits, LSB first, TMS unchanged, dap_io.c)
+extern void JTAG_WriteBits(uint8_t val, uint8_t n);
+extern uint8_t JTAG_ReadBits(uint8_t n);
+extern uint8_t JTAG_ShiftBits(uint8_t val, uint8_t n);
+#define JTAG_WriteByte(val)   JTAG_WriteBits(val, 8)
+#define JTAG_ReadByte()       JTAG_ReadBits(8)
+
+// HID transfer buffers (current slot of the HID packet ring)
+#define DAP_READ_BUF_PTR      HID_requestBuffer[HID_execIndex]
+#define DAP_WRITE_BUF_PTR     HID_responseBuffer[HID_execIndex]
+extern __xdata uint8_t HID_requestBuffer[][64];
+extern __xdata uint8_t HID_responseBuffer[][64];
+extern uint8_t HID_execIndex;
 
 // DAP init function
-#define DAP_init()            HID_init(); PORT_SETUP();
+#define DAP_init()            HID_init(); PORT_SETUP(); TIMESTAMP_SETUP();
 extern void HID_init(void);
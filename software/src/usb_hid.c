@@ -7,12 +7,74 @@
 #include "usb_hid.h"
 #include "usb_descr.h"
 #include "usb_handler.h"
+#include "dap.h"
 
 // ===================================================================================
 // Variables and Defines
 // ===================================================================================
 
-volatile __xdata uint8_t HID_byteCount = 0; // received bytes in endpoint
+// DAP packet ring: EP1 OUT keeps receiving requests while DAP_Thread is busy
+__xdata uint8_t HID_requestBuffer[DAP_PACKET_COUNT][DAP_PACKET_SIZE];
+__xdata uint8_t HID_responseBuffer[DAP_PACKET_COUNT][DAP_PACKET_SIZE];
+
+volatile uint8_t HID_requestCount  = 0;     // received requests waiting for execution
+volatile uint8_t HID_responseCount = 0;     // prepared responses waiting for EP1 IN
+volatile __bit   HID_writeBusyFlag = 0;     // flag of whether EP1 IN buffer is loaded
+uint8_t HID_recvIndex = 0;                  // ring slot for next received request
+uint8_t HID_execIndex = 0;                  // ring slot of request being executed
+uint8_t HID_sendIndex = 0;                  // ring slot of next response to send
+
+// ===================================================================================
+// Fast Copy Functions
+// ===================================================================================
+
+// Copy received packet from EP1 OUT buffer to ring slot using double pointer
+void HID_copyFromEP1(__xdata uint8_t *dst) __naked {
+  dst;                          // stop unreferenced argument warning
+  __asm
+    mov  r6, dpl                ; r6 <- dst low byte
+    mov  r7, dph                ; r7 <- dst high byte
+    inc  _XBUS_AUX              ; select dptr1
+    mov  dpl, r6                ; dptr1 <- dst
+    mov  dph, r7
+    dec  _XBUS_AUX              ; select dptr0
+    mov  dptr, #_EP1_buffer     ; dptr0 <- EP1 OUT buffer
+    mov  r7, #64                ; r7 <- packet size
+    01$:
+    movx a, @dptr               ; acc <- EP1_buffer[dptr0]
+    inc  dptr                   ; inc dptr0
+    .DB  0xA5                   ; acc -> dst[dptr1] & inc dptr1
+    djnz r7, 01$                ; repeat 64 times
+    ret
+  __endasm;
+}
+
+// Copy response from ring slot to EP1 IN buffer using double pointer
+void HID_copyToEP1(__xdata uint8_t *src) __naked {
+  src;                          // stop unreferenced argument warning
+  __asm
+    inc  _XBUS_AUX              ; select dptr1
+    mov  dptr, #(_EP1_buffer + 64) ; dptr1 <- EP1 IN buffer
+    dec  _XBUS_AUX              ; select dptr0 (src)
+    mov  r7, #64                ; r7 <- packet size
+    01$:
+    movx a, @dptr               ; acc <- src[dptr0]
+    inc  dptr                   ; inc dptr0
+    .DB  0xA5                   ; acc -> EP1_buffer[dptr1] & inc dptr1
+    djnz r7, 01$                ; repeat 64 times
+    ret
+  __endasm;
+}
+
+// Load next prepared response into EP1 IN buffer and release its ring slot
+void HID_sendResponse(void) {
+  HID_copyToEP1(HID_responseBuffer[HID_sendIndex]);
+  if(++HID_sendIndex == DAP_PACKET_COUNT) HID_sendIndex = 0;
+  HID_responseCount--;
+  HID_writeBusyFlag = 1;
+  UEP1_T_LEN = 64;                          // Windows hangs if smaller
+  UEP1_CTRL = UEP1_CTRL & ~(MASK_UEP_R_RES | MASK_UEP_T_RES); // send/receive package
+}
 
 // ===================================================================================
 // Front End Functions
@@ -24,6 +86,32 @@ void HID_init(void) {
   UEP1_T_LEN  = 0;
 }
 
+// Check if a DAP request is ready to be executed
+__bit HID_available(void) {
+  uint8_t i, n;
+  if(!HID_requestCount) return 0;
+
+  // Queued commands are held back until a packet with another command arrives
+  i = HID_execIndex;
+  for(n = HID_requestCount; n; n--) {
+    if(HID_requestBuffer[i][0] != ID_DAP_QueueCommands) return 1;
+    if(++i == DAP_PACKET_COUNT) i = 0;
+  }
+  return(HID_requestCount == DAP_PACKET_COUNT); // ring full, execute anyway
+}
+
+// Pass prepared response of the executed request on to EP1 IN
+void HID_transmit(void) {
+  EA = 0;                                   // no interrupts while handing over
+  if(HID_requestCount) {                    // (counters are cleared by bus reset)
+    if(++HID_execIndex == DAP_PACKET_COUNT) HID_execIndex = 0;
+    HID_requestCount--;
+    HID_responseCount++;
+    if(!HID_writeBusyFlag) HID_sendResponse();
+  }
+  EA = 1;
+}
+
 // ===================================================================================
 // HID-Specific USB Handler Functions
 // ===================================================================================
@@ -41,21 +129,37 @@ void HID_setup(void) {
 // Reset HID parameters
 void HID_reset(void) {
   UEP1_CTRL = bUEP_AUTO_TOG | UEP_T_RES_NAK | UEP_R_RES_ACK;
-  HID_byteCount = 0;
+  HID_requestCount  = 0;
+  HID_responseCount = 0;
+  HID_writeBusyFlag = 0;
+  HID_recvIndex = 0;
+  HID_execIndex = 0;
+  HID_sendIndex = 0;
 }
 
 // Endpoint 1 IN handler (HID report transfer to host)
 void HID_EP1_IN(void) {
-  UEP1_T_LEN = 0;                                           // no data to send anymore
-  UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_NAK;  // default NAK
+  if(HID_responseCount) HID_sendResponse();                   // next response ready
+  else {
+    HID_writeBusyFlag = 0;
+    UEP1_T_LEN = 0;                                           // no data to send anymore
+    UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_T_RES | UEP_T_RES_NAK;  // default NAK
+  }
 }
 
 // Endpoint 1 OUT handler (HID report transfer from host)
 void HID_EP1_OUT(void) {
-  if(U_TOG_OK) {                            // discard unsynchronized packets
-    HID_byteCount = USB_RX_LEN;
-    if(HID_byteCount)
-      // Respond NAK after a packet. Let main code change response after handling.
+  if(U_TOG_OK && USB_RX_LEN) {              // discard unsynchronized packets
+    if(EP1_buffer[0] == ID_DAP_TransferAbort) {
+      // Abort request cancels a running transfer at once and is not queued
+      DAP_TransferAbort = 1;
+      return;
+    }
+    HID_copyFromEP1(HID_requestBuffer[HID_recvIndex]);
+    if(++HID_recvIndex == DAP_PACKET_COUNT) HID_recvIndex = 0;
+    HID_requestCount++;
+    if((uint8_t)(HID_requestCount + HID_responseCount) == DAP_PACKET_COUNT)
+      // Ring is full. Respond NAK until a response has been sent.
       UEP1_CTRL = UEP1_CTRL & ~MASK_UEP_R_RES | UEP_R_RES_NAK;
   }
 }
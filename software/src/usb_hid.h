@@ -6,3 +6,5 @@
 #include <stdint.h>
 
 void HID_init(void);                                      // setup USB-HID
+__bit HID_available(void);                                // check if DAP request is ready
+void HID_transmit(void);                                  // send response of DAP request